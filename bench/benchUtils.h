@@ -0,0 +1,31 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <vector>
+
+namespace asciidag::bench {
+
+/// Runs f() `repetitions` times and returns the median wall-clock time in seconds
+template <typename F>
+double medianSeconds(F&& f, size_t repetitions) {
+  std::vector<double> samples;
+  samples.reserve(repetitions);
+  for (size_t i = 0; i < repetitions; ++i) {
+    auto start = std::chrono::steady_clock::now();
+    f();
+    auto finish = std::chrono::steady_clock::now();
+    samples.push_back(std::chrono::duration<double>(finish - start).count());
+  }
+  std::nth_element(samples.begin(), samples.begin() + samples.size() / 2, samples.end());
+  return samples[samples.size() / 2];
+}
+
+/// Keeps the compiler from optimizing away a computed value
+template <typename T>
+void doNotOptimize(T const& value) {
+  asm volatile("" : : "r,m"(value) : "memory");
+}
+
+} // namespace asciidag::bench
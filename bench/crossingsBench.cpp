@@ -0,0 +1,69 @@
+#include "asciidagImpl.h"
+#include "benchUtils.h"
+#include "testUtils.h"
+
+#include <iostream>
+#include <random>
+
+using namespace asciidag;
+using namespace asciidag::detail;
+using namespace asciidag::bench;
+using asciidag::tests::countCrossingsPairwise;
+
+namespace {
+
+struct Bilayer {
+  DAG dag;
+  Vec<size_t> above;
+  Vec<size_t> below;
+};
+
+Bilayer randomBilayer(size_t width, size_t maxDegree, std::mt19937_64& gen) {
+  Bilayer ret;
+  ret.dag.nodes.resize(2 * width, {{}, "n"});
+  for (size_t i = 0; i < width; ++i) {
+    ret.above.push_back(i);
+    ret.below.push_back(width + i);
+    size_t degree = 1 + gen() % maxDegree;
+    for (size_t d = 0; d < degree; ++d) {
+      ret.dag.nodes[i].succs.push_back(width + gen() % width);
+    }
+    auto& succs = ret.dag.nodes[i].succs;
+    std::sort(succs.begin(), succs.end());
+    succs.erase(std::unique(succs.begin(), succs.end()), succs.end());
+  }
+  std::shuffle(ret.below.begin(), ret.below.end(), gen);
+  return ret;
+}
+
+} // namespace
+
+int main() {
+  std::mt19937_64 gen(2024);
+  std::cout << "width  edges  crossings  pairwise[ms]  accumulator[ms]  speedup\n";
+  for (size_t width : {125, 250, 500}) {
+    auto const layers = randomBilayer(width, 3, gen);
+    size_t nEdges = 0;
+    for (auto const& node : layers.dag.nodes) {
+      nEdges += node.succs.size();
+    }
+    GraphIndex const index(layers.dag);
+    size_t const expected = countCrossingsPairwise(layers.dag, layers.above, layers.below);
+    if (expected != countCrossings(index, layers.above, layers.below)) {
+      std::cerr << "Mismatch on width " << width << "\n";
+      return 1;
+    }
+    double pairwise = medianSeconds(
+      [&] { doNotOptimize(countCrossingsPairwise(layers.dag, layers.above, layers.below)); },
+      1
+    );
+    double accumulator = medianSeconds(
+      [&] { doNotOptimize(countCrossings(index, layers.above, layers.below)); },
+      11
+    );
+    std::cout
+      << width << "  " << nEdges << "  " << expected << "  " << pairwise * 1e3 << "  "
+      << accumulator * 1e3 << "  " << pairwise / accumulator << "x\n";
+  }
+  return 0;
+}
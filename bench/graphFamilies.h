@@ -0,0 +1,95 @@
+#pragma once
+
+#include "asciidag.h"
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <random>
+#include <string>
+#include <vector>
+
+/// The graph families of test/parseRenderTest.cpp
+namespace asciidag::bench {
+
+inline std::string rectLabel(char filler, size_t width, size_t height) {
+  std::string ret;
+  for (size_t line = 0; line < height; ++line) {
+    if (line != 0) {
+      ret += '\n';
+    }
+    ret.append(width, filler);
+  }
+  return ret;
+}
+
+inline DAG graphNodesFromSeed(size_t seed, size_t size) {
+  DAG ret;
+  for (size_t i = 0; i < size; ++i) {
+    size_t width = 1 + (seed & 0b111);
+    seed >>= 3;
+    size_t height = 1 + (seed & 0b111);
+    seed >>= 3;
+    ret.nodes.push_back({{}, rectLabel(static_cast<char>('0' + i), width, height)});
+  }
+  return ret;
+}
+
+inline size_t labelWidth(std::string const& text) {
+  return std::find(text.begin(), text.end(), '\n') - text.begin();
+}
+
+inline void configureDAGFromSeed(DAG& dag, size_t seed) {
+  for (auto& node : dag.nodes) {
+    node.succs.clear();
+  }
+  std::vector<size_t> nPreds(dag.nodes.size(), 0);
+  size_t shift = 0;
+  for (size_t node = 0; node < dag.nodes.size(); ++node) {
+    size_t nodeWidth = labelWidth(dag.nodes[node].text);
+    for (size_t succ = node + 1; succ < dag.nodes.size(); ++succ) {
+      if (2 + nodeWidth <= dag.nodes[node].succs.size()) {
+        break;
+      }
+      if (2 + labelWidth(dag.nodes[succ].text) <= nPreds[succ]) {
+        continue;
+      }
+      if (seed & (size_t{1} << shift)) {
+        dag.nodes[node].succs.push_back(succ);
+        ++nPreds[succ];
+      }
+      ++shift;
+    }
+  }
+}
+
+inline std::array<std::string, 6> const nodeLabelUp = {"0", "11", "222", "3333", "44444", "555555"};
+
+inline std::array<std::string, 6> const nodeLabelDeeper = {
+  "0", "1\n1", "2\n2\n2", "3\n3\n3\n3", "4\n4\n4\n4\n4", "5\n5\n5\n5\n5\n5"
+};
+
+/// Calls visit on every DAG over the nodes labeled by labels
+template <size_t N, typename Visit>
+void forAllGraphs(std::array<std::string, N> const& labels, Visit&& visit) {
+  DAG dag;
+  for (auto const& label : labels) {
+    dag.nodes.push_back({{}, label});
+  }
+  for (size_t seed = 0; seed < (size_t{1} << (N * (N - 1) / 2)); ++seed) {
+    configureDAGFromSeed(dag, seed);
+    visit(dag);
+  }
+}
+
+/// Calls visit on count random DAGs of nodeCount nodes
+template <typename Visit>
+void forRandomGraphs(size_t nodeCount, size_t count, std::mt19937_64& gen, Visit&& visit) {
+  for (size_t i = 0; i < count; ++i) {
+    DAG dag = graphNodesFromSeed(gen(), nodeCount);
+    configureDAGFromSeed(dag, gen());
+    visit(dag);
+  }
+}
+
+} // namespace asciidag::bench
@@ -0,0 +1,69 @@
+#include "asciidagImpl.h"
+#include "benchUtils.h"
+#include "graphFamilies.h"
+
+#include <iostream>
+#include <random>
+#include <string>
+
+using namespace asciidag;
+using namespace asciidag::detail;
+using namespace asciidag::bench;
+
+namespace {
+
+struct Totals {
+  size_t waypoints = 0;
+  size_t rendered = 0;
+  double seconds = 0;
+};
+
+void measure(DAG const& dag, RenderOptions const& options, Totals& totals) {
+  GraphIndex index(dag);
+  Layering layers;
+  if (layerDAG(index, layers, options)) {
+    return;
+  }
+  totals.waypoints += index.size() - dag.nodes.size();
+  RenderError err;
+  bool ok = false;
+  totals.seconds += medianSeconds([&] { ok = renderDAG(dag, err, options).has_value(); }, 1);
+  totals.rendered += ok ? 1 : 0;
+}
+
+template <typename ForEachDAG>
+void compare(std::string const& family, ForEachDAG&& forEachDAG) {
+  RenderOptions longestPath;
+  longestPath.threads = 1;
+  RenderOptions minimumSpan = longestPath;
+  minimumSpan.layerAssignment = RenderOptions::LayerAssignment::MinimumSpan;
+  Totals before;
+  Totals after;
+  size_t nGraphs = 0;
+  forEachDAG([&](DAG const& dag) {
+    ++nGraphs;
+    measure(dag, longestPath, before);
+    measure(dag, minimumSpan, after);
+  });
+  std::cout
+    << family << "  " << nGraphs << "  " << before.waypoints << "  " << after.waypoints << "  "
+    << before.seconds * 1e3 << "  " << after.seconds * 1e3 << "  " << before.rendered << "  "
+    << after.rendered << "\n";
+}
+
+} // namespace
+
+int main() {
+  std::cout
+    << "family  graphs  waypoints(longest)  waypoints(minspan)  render(longest)[ms]  "
+       "render(minspan)[ms]  rendered(longest)  rendered(minspan)\n";
+  compare("all-6-up", [](auto&& visit) { forAllGraphs(nodeLabelUp, visit); });
+  compare("all-6-deeper", [](auto&& visit) { forAllGraphs(nodeLabelDeeper, visit); });
+  for (size_t nodeCount : {8, 10}) {
+    compare("random-" + std::to_string(nodeCount), [nodeCount](auto&& visit) {
+      std::mt19937_64 gen(nodeCount);
+      forRandomGraphs(nodeCount, 2000, gen, visit);
+    });
+  }
+  return 0;
+}
@@ -0,0 +1,103 @@
+#include "asciidagImpl.h"
+#include "benchUtils.h"
+#include "graphFamilies.h"
+
+#include <iostream>
+#include <random>
+#include <string>
+
+using namespace asciidag;
+using namespace asciidag::detail;
+using namespace asciidag::bench;
+
+namespace {
+
+/// Up to 3 successors for every node, among the 8 next ones
+DAG sparseDAG(size_t nodeCount, std::mt19937_64& gen) {
+  DAG ret;
+  for (size_t i = 0; i < nodeCount; ++i) {
+    ret.nodes.push_back({{}, std::to_string(i)});
+  }
+  std::vector<size_t> nPreds(nodeCount, 0);
+  for (size_t n = 0; n < nodeCount; ++n) {
+    size_t const nSuccs = gen() % 4;
+    for (size_t succ = n + 1; succ < std::min(n + 9, nodeCount); ++succ) {
+      if (ret.nodes[n].succs.size() < nSuccs && nPreds[succ] < 3 && gen() % 3 == 0) {
+        ret.nodes[n].succs.push_back(succ);
+        ++nPreds[succ];
+      }
+    }
+  }
+  return ret;
+}
+
+struct Scheme {
+  std::string name;
+  RenderOptions options;
+};
+
+struct Totals {
+  size_t crossings = 0;
+  double seconds = 0;
+};
+
+/// Crossings left by the first ordering of the layers, before any crossing node is inserted
+void measure(DAG const& dag, RenderOptions const& options, Totals& totals) {
+  GraphIndex index(dag);
+  Layering layers;
+  if (layerDAG(index, layers, options)) {
+    return;
+  }
+  totals.seconds += medianSeconds([&] { minimizeCrossings(layers, index, options); }, 1);
+  for (size_t layerI = 1; layerI < layers.size(); ++layerI) {
+    totals.crossings += countCrossings(index, layers, layerI - 1);
+  }
+}
+
+template <typename ForEachDAG>
+void compare(std::string const& family, std::vector<Scheme> const& schemes, ForEachDAG&& forEachDAG) {
+  std::vector<Totals> totals(schemes.size());
+  forEachDAG([&](DAG const& dag) {
+    for (size_t i = 0; i < schemes.size(); ++i) {
+      measure(dag, schemes[i].options, totals[i]);
+    }
+  });
+  for (size_t i = 0; i < schemes.size(); ++i) {
+    std::cout
+      << family << "  " << schemes[i].name << "  " << totals[i].crossings << "  "
+      << totals[i].seconds * 1e3 << "\n";
+  }
+}
+
+} // namespace
+
+int main() {
+  std::vector<Scheme> schemes(5);
+  schemes[0].name = "barycenter-fixed";
+  schemes[1].name = "barycenter-sweeps";
+  schemes[1].options.maxSweeps = 16;
+  schemes[2].name = "median-fixed";
+  schemes[2].options.crossingHeuristic = RenderOptions::CrossingHeuristic::Median;
+  schemes[3].name = "median-sweeps";
+  schemes[3].options = schemes[2].options;
+  schemes[3].options.maxSweeps = 16;
+  schemes[4].name = "barycenter-sifting";
+  schemes[4].options.crossingReduction = RenderOptions::CrossingReduction::Sifting;
+
+  std::cout << "family  scheme  crossings  ordering[ms]\n";
+  compare("all-6-up", schemes, [](auto&& visit) { forAllGraphs(nodeLabelUp, visit); });
+  compare("all-6-deeper", schemes, [](auto&& visit) { forAllGraphs(nodeLabelDeeper, visit); });
+  compare("random-10", schemes, [](auto&& visit) {
+    std::mt19937_64 gen(10);
+    forRandomGraphs(10, 2000, gen, visit);
+  });
+  for (size_t nodeCount : {30, 100}) {
+    compare("sparse-" + std::to_string(nodeCount), schemes, [nodeCount](auto&& visit) {
+      std::mt19937_64 gen(nodeCount);
+      for (size_t i = 0; i < 200; ++i) {
+        visit(sparseDAG(nodeCount, gen));
+      }
+    });
+  }
+  return 0;
+}
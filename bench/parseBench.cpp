@@ -0,0 +1,75 @@
+#include "asciidag.h"
+#include "benchUtils.h"
+
+#include <iostream>
+#include <string>
+
+using namespace asciidag;
+using namespace asciidag::bench;
+
+namespace {
+
+/// `layers` rows of `width` nodes, each connected to the node below it.
+/// Mostly whitespace, like the diagrams produced by renderDAG.
+std::string gridDiagram(size_t width, size_t layers, size_t gap) {
+  std::string const pad(gap, ' ');
+  std::string nodeLine;
+  std::string edgeLine;
+  for (size_t i = 0; i < width; ++i) {
+    nodeLine += pad + "node";
+    edgeLine += pad + " |  ";
+  }
+  std::string ret;
+  for (size_t l = 0; l < layers; ++l) {
+    ret += nodeLine + "\n";
+    if (l + 1 < layers) {
+      ret += edgeLine + "\n";
+    }
+  }
+  return ret;
+}
+
+size_t parseWhole(std::string const& str) {
+  ParseError err;
+  auto dag = parseDAG(str, err);
+  return dag ? dag->nodes.size() : 0;
+}
+
+size_t parseInPlace(std::string const& str) {
+  ParseError err;
+  auto dag = parseDAGInPlace(str, err);
+  return dag ? dag->nodes.size() : 0;
+}
+
+size_t parseByteByByte(std::string const& str) {
+  ParseSession session;
+  for (char c : str) {
+    session.feed(std::string_view(&c, 1));
+  }
+  ParseError err;
+  auto dag = session.finish(err);
+  return dag ? dag->nodes.size() : 0;
+}
+
+} // namespace
+
+int main() {
+  std::cout << "gap  size[MB]  whole[MB/s]  in-place[MB/s]  byte-by-byte[MB/s]\n";
+  for (size_t gap : {4, 16, 64}) {
+    auto const diagram = gridDiagram(64, 2000, gap);
+    size_t const nNodes = 64 * 2000;
+    if (parseWhole(diagram) != nNodes || parseInPlace(diagram) != nNodes
+        || parseByteByByte(diagram) != nNodes) {
+      std::cerr << "Failed to parse the diagram with gap " << gap << "\n";
+      return 1;
+    }
+    double const megabytes = static_cast<double>(diagram.size()) / 1e6;
+    double whole = medianSeconds([&] { doNotOptimize(parseWhole(diagram)); }, 5);
+    double inPlace = medianSeconds([&] { doNotOptimize(parseInPlace(diagram)); }, 5);
+    double byteByByte = medianSeconds([&] { doNotOptimize(parseByteByByte(diagram)); }, 5);
+    std::cout
+      << gap << "  " << megabytes << "  " << megabytes / whole << "  " << megabytes / inPlace
+      << "  " << megabytes / byteByByte << "\n";
+  }
+  return 0;
+}
@@ -4,68 +4,463 @@
 
 #include <algorithm>
 #include <array>
+#include <atomic>
 #include <cassert>
 #include <cstddef>
+#include <cstdint>
+#include <functional>
 #include <iostream>
+#include <limits>
+#include <memory_resource>
+#include <numeric>
 #include <optional>
+#include <queue>
 #include <set>
 #include <sstream>
 #include <string>
+#include <thread>
 #include <unistd.h>
 #include <unordered_map>
-#include <unordered_set>
 #include <vector>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 namespace asciidag {
 
 constexpr auto sketchMode = true;
-auto waypointText = "|";
+constexpr char waypointChar = '|';
+constexpr char crossChar = 'X';
 
 namespace {
 #define LOG(expr) /* nothing */
 //#define LOG(expr) std::cout << expr
 
-#define LOGDAGL(dag, layers, title) \
- LOG("--- " << title << "---\n" << renderDAGWithLayers(dag, layers) <<"\n ---- \n")
+#define LOGDAGL(dag, index, layers, title) \
+ LOG("--- " << title << "---\n" << renderDAGWithLayers(dag, index, layers) <<"\n ---- \n")
 
 using namespace asciidag::detail;
 
-size_t findIndex(Vec<size_t> const list, size_t val) {
-  // This linear search might better be replaced with a lookup table
-  for (size_t pos = 0; pos < list.size(); ++pos) {
-    if (list[pos] == val) {
-      return pos;
+/// Layers holding the nodes of every rank, each ordered by node id
+Layering layeringFromRanks(Vec<size_t> const& rank) {
+  size_t maxRank = *std::max_element(rank.begin(), rank.end());
+  Vec2<size_t> ret(maxRank + 1);
+  for (size_t n = 0; n < rank.size(); ++n) {
+    ret[rank[n]].push_back(n);
+  }
+  return Layering(std::move(ret));
+}
+
+std::optional<RenderError> dagLayers(GraphIndex const& index, Layering& layers) {
+  // Longest-path ranking in topological (Kahn) order: linear in edges
+  size_t const N = index.size();
+  Vec<size_t> nUnrankedPreds(N, 0);
+  for (size_t n = 0; n < N; ++n) {
+    nUnrankedPreds[n] = index.preds(n).size();
+  }
+  Vec<size_t> queue;
+  queue.reserve(N);
+  for (size_t n = 0; n < N; ++n) {
+    if (nUnrankedPreds[n] == 0) {
+      queue.push_back(n);
     }
   }
-  assert(false && "The node must be in this list");
-  return 0;
+  Vec<size_t> rank(N, 0);
+  for (size_t head = 0; head < queue.size(); ++head) {
+    size_t n = queue[head];
+    for (size_t succ : index.succs(n)) {
+      rank[succ] = std::max(rank[succ], rank[n] + 1);
+      if (--nUnrankedPreds[succ] == 0) {
+        queue.push_back(succ);
+      }
+    }
+  }
+  if (queue.size() < N) {
+    // The nodes never released from the queue are on a cycle or reachable only through one
+    auto stuck = std::find_if(nUnrankedPreds.begin(), nUnrankedPreds.end(), [](size_t count) {
+      return count != 0;
+    });
+    return {
+      {RenderError::Code::Cyclic,
+       "The graph has a cycle, it is not a DAG.",
+       static_cast<size_t>(stuck - nUnrankedPreds.begin())}
+    };
+  }
+  layers = layeringFromRanks(rank);
+  return {};
 }
 
-Vec2<size_t> dagLayers(DAG const& dag) {
-  // TODO: optimize using a queue (linear in edges)
-  // instead of a fix-point (quadratic in edges)
-  Vec<size_t> rank(dag.nodes.size(), 0);
-  bool changed = false;
-  do {
-    changed = false;
-    for (size_t n = 0; n < dag.nodes.size(); ++n) {
-      for (auto const& e : dag.nodes[n].succs) {
-        if (rank[e] < rank[n] + 1) {
-          changed = true;
-          rank[e] = rank[n] + 1;
-        }
+/// Coffman-Graham layering, mirrored to fill the layers from the top.
+/// Every node gets a label once its successors have one,
+/// the node with the lexicographically smallest decreasing list of successor labels first.
+/// Then the layers are filled top-down with at most maxWidth nodes (0 for no bound),
+/// taking the highest label among the nodes whose predecessors are all in the layers above.
+/// The graph must be acyclic.
+Layering widthBoundedLayers(GraphIndex const& index, size_t maxWidth) {
+  size_t const N = index.size();
+  Vec<size_t> label(N, 0);
+  Vec<size_t> nUnlabeledSuccs(N);
+  using Key = std::pair<Vec<size_t>, size_t>;
+  std::priority_queue<Key, Vec<Key>, std::greater<>> labelable;
+  auto keyOf = [&index, &label](size_t n) {
+    Vec<size_t> succLabels;
+    succLabels.reserve(index.succs(n).size());
+    for (size_t succ : index.succs(n)) {
+      succLabels.push_back(label[succ]);
+    }
+    std::sort(succLabels.begin(), succLabels.end(), std::greater<>());
+    return Key{std::move(succLabels), n};
+  };
+  for (size_t n = 0; n < N; ++n) {
+    nUnlabeledSuccs[n] = index.succs(n).size();
+    if (nUnlabeledSuccs[n] == 0) {
+      labelable.push(keyOf(n));
+    }
+  }
+  for (size_t nextLabel = 1; !labelable.empty(); ++nextLabel) {
+    size_t n = labelable.top().second;
+    labelable.pop();
+    label[n] = nextLabel;
+    for (size_t pred : index.preds(n)) {
+      if (--nUnlabeledSuccs[pred] == 0) {
+        labelable.push(keyOf(pred));
       }
     }
-  } while (changed);
-  size_t maxRank = *std::max_element(rank.begin(), rank.end());
-  Vec2<size_t> ret(maxRank + 1);
-  for (size_t n = 0; n < dag.nodes.size(); ++n) {
-    ret[rank[n]].push_back(n);
   }
-  return ret;
+
+  Vec<size_t> rank(N, 0);
+  Vec<size_t> nUnplacedPreds(N);
+  // (label, node) of the nodes that can go to the current layer
+  std::priority_queue<std::pair<size_t, size_t>, Vec<std::pair<size_t, size_t>>> placeable;
+  // Nodes with a predecessor in the current layer, they can go to the next one
+  Vec<size_t> placeableBelow;
+  for (size_t n = 0; n < N; ++n) {
+    nUnplacedPreds[n] = index.preds(n).size();
+    if (nUnplacedPreds[n] == 0) {
+      placeable.push({label[n], n});
+    }
+  }
+  size_t layerI = 0;
+  size_t layerSize = 0;
+  while (!placeable.empty()) {
+    size_t n = placeable.top().second;
+    placeable.pop();
+    rank[n] = layerI;
+    ++layerSize;
+    for (size_t succ : index.succs(n)) {
+      if (--nUnplacedPreds[succ] == 0) {
+        placeableBelow.push_back(succ);
+      }
+    }
+    if (placeable.empty() || layerSize == maxWidth) {
+      ++layerI;
+      layerSize = 0;
+      for (size_t below : placeableBelow) {
+        placeable.push({label[below], below});
+      }
+      placeableBelow.clear();
+    }
+  }
+  return layeringFromRanks(rank);
 }
 
-void replace(Vec<size_t>& values, size_t dated, size_t updated) {
+/// Network simplex (Gansner et al.) over the layer constraints:
+/// finds the ranks with the smallest total edge span, every edge spanning at least one layer.
+/// Works on a spanning forest of tight edges (spanning exactly one layer),
+/// replacing a tree edge with a negative cut value by the tightest non-tree edge across its cut
+/// until no such tree edge remains.
+class MinimumSpanRanking {
+public:
+  MinimumSpanRanking(GraphIndex const& index, Layering const& feasible) : rank(index.size()) {
+    size_t const N = index.size();
+    for (size_t n = 0; n < N; ++n) {
+      rank[n] = static_cast<long>(feasible.layerOf(n));
+      for (size_t succ : index.succs(n)) {
+        edges.push_back({n, succ, 1});
+      }
+    }
+    // Parallel edges weigh as much as the edges they replace
+    std::sort(edges.begin(), edges.end(), [](Edge const& a, Edge const& b) {
+      return std::tie(a.from, a.to) < std::tie(b.from, b.to);
+    });
+    Vec<Edge> merged;
+    for (auto const& e : edges) {
+      if (!merged.empty() && merged.back().from == e.from && merged.back().to == e.to) {
+        ++merged.back().weight;
+      } else {
+        merged.push_back(e);
+      }
+    }
+    edges = std::move(merged);
+    incident.resize(N);
+    for (size_t e = 0; e < edges.size(); ++e) {
+      incident[edges[e].from].push_back(e);
+      incident[edges[e].to].push_back(e);
+    }
+    inTree.assign(edges.size(), false);
+    parent.resize(N);
+    parentEdge.resize(N);
+    low.resize(N);
+    lim.resize(N);
+    postorder.resize(N);
+    treeRoot.resize(N);
+    cutValue.resize(edges.size());
+  }
+
+  Vec<size_t> solve() {
+    buildFeasibleForest();
+    numberTrees();
+    size_t searchStart = 0;
+    while (auto leaving = findNegativeCut(searchStart)) {
+      exchange(*leaving, findEnteringEdge(*leaving));
+      searchStart = *leaving;
+      assert(matchesRebuiltTree());
+    }
+    long minRank = *std::min_element(rank.begin(), rank.end());
+    Vec<size_t> ret(rank.size());
+    for (size_t n = 0; n < rank.size(); ++n) {
+      ret[n] = static_cast<size_t>(rank[n] - minRank);
+    }
+    return ret;
+  }
+
+private:
+  struct Edge {
+    size_t from;
+    size_t to;
+    long weight;
+  };
+
+  static constexpr size_t none = std::numeric_limits<size_t>::max();
+
+  long slack(size_t e) const { return rank[edges[e].to] - rank[edges[e].from] - 1; }
+  size_t other(size_t e, size_t n) const { return edges[e].from == n ? edges[e].to : edges[e].from; }
+  bool inSubtree(size_t n, size_t subtreeRoot) const {
+    return low[subtreeRoot] <= lim[n] && lim[n] <= lim[subtreeRoot];
+  }
+
+  /// Grows a tree of tight edges from every node not covered yet,
+  /// shifting the tree to make the least slack edge leaving it tight, until none leaves it
+  void buildFeasibleForest() {
+    size_t const N = rank.size();
+    Vec<bool> covered(N, false);
+    Vec<size_t> tree;
+    for (size_t start = 0; start < N; ++start) {
+      if (covered[start]) {
+        continue;
+      }
+      covered[start] = true;
+      tree.assign(1, start);
+      while (true) {
+        for (size_t i = 0; i < tree.size(); ++i) {
+          for (size_t e : incident[tree[i]]) {
+            size_t n = other(e, tree[i]);
+            if (!covered[n] && slack(e) == 0) {
+              covered[n] = true;
+              inTree[e] = true;
+              tree.push_back(n);
+            }
+          }
+        }
+        std::optional<size_t> tightest;
+        for (size_t n : tree) {
+          for (size_t e : incident[n]) {
+            if (!covered[other(e, n)] && (!tightest || slack(e) < slack(*tightest))) {
+              tightest = e;
+            }
+          }
+        }
+        if (!tightest) {
+          break;
+        }
+        long delta = covered[edges[*tightest].from] ? slack(*tightest) : -slack(*tightest);
+        for (size_t n : tree) {
+          rank[n] += delta;
+        }
+      }
+    }
+  }
+
+  /// Numbers every tree of the forest and computes the cut values of all the tree edges
+  void numberTrees() {
+    size_t const N = rank.size();
+    std::fill(parent.begin(), parent.end(), none);
+    std::fill(parentEdge.begin(), parentEdge.end(), none);
+    Vec<bool> numbered(N, false);
+    size_t next = 0;
+    for (size_t root = 0; root < N; ++root) {
+      if (numbered[root]) {
+        continue;
+      }
+      size_t const first = next;
+      next = numberSubtree(root, first);
+      for (size_t i = first; i < next; ++i) {
+        numbered[postorder[i]] = true;
+        treeRoot[postorder[i]] = root;
+      }
+    }
+    for (size_t n : postorder) {
+      if (parent[n] != none) {
+        cutValue[parentEdge[n]] = computeCutValue(n);
+      }
+    }
+  }
+
+  /// Sets the parents below `root` and numbers its subtree in postorder from `first` on,
+  /// returns the number after the last one
+  size_t numberSubtree(size_t root, size_t first) {
+    size_t next = first;
+    Vec<std::pair<size_t, size_t>> stack; // node, next incident edge to look at
+    stack.push_back({root, 0});
+    low[root] = first;
+    while (!stack.empty()) {
+      auto& [n, nextEdge] = stack.back();
+      if (nextEdge < incident[n].size()) {
+        size_t e = incident[n][nextEdge++];
+        if (inTree[e] && e != parentEdge[n]) {
+          size_t child = other(e, n);
+          parent[child] = n;
+          parentEdge[child] = e;
+          low[child] = next;
+          stack.push_back({child, 0});
+        }
+        continue;
+      }
+      lim[n] = next;
+      postorder[next++] = n;
+      stack.pop_back();
+    }
+    return next;
+  }
+
+  /// Cut value of the tree edge between child and its parent,
+  /// given the cut values of the tree edges below child
+  long computeCutValue(size_t child) const {
+    size_t const treeEdge = parentEdge[child];
+    bool const childIsTail = edges[treeEdge].from == child;
+    long ret = edges[treeEdge].weight;
+    for (size_t e : incident[child]) {
+      if (e == treeEdge) {
+        continue;
+      }
+      bool const pointsToHead = (edges[e].from == child) == childIsTail;
+      ret += pointsToHead ? edges[e].weight : -edges[e].weight;
+      if (inTree[e]) {
+        ret += pointsToHead ? -cutValue[e] : cutValue[e];
+      }
+    }
+    return ret;
+  }
+
+  /// Replaces the leaving tree edge with the entering one. Only the ranks of one of the two parts
+  /// the leaving edge separates, the cut values on the tree path between the ends of the entering
+  /// edge, and the numbering below the top of that path change (Gansner et al.)
+  void exchange(size_t leaving, size_t entering) {
+    size_t const subtreeRoot =
+      parent[edges[leaving].from] == edges[leaving].to ? edges[leaving].from : edges[leaving].to;
+    // Make the entering edge tight by moving the smaller part
+    long const delta = inSubtree(edges[entering].from, subtreeRoot) ? slack(entering)
+                                                                     : -slack(entering);
+    size_t const root = treeRoot[subtreeRoot];
+    size_t const subtreeSize = lim[subtreeRoot] + 1 - low[subtreeRoot];
+    if (2 * subtreeSize <= lim[root] + 1 - low[root]) {
+      for (size_t i = low[subtreeRoot]; i <= lim[subtreeRoot]; ++i) {
+        rank[postorder[i]] += delta;
+      }
+    } else {
+      for (size_t i = low[root]; i <= lim[root]; ++i) {
+        if (i < low[subtreeRoot] || lim[subtreeRoot] < i) {
+          rank[postorder[i]] -= delta;
+        }
+      }
+    }
+    long const cut = cutValue[leaving];
+    size_t const top = addCutOnPath(edges[entering].from, edges[entering].to, cut, true);
+    [[maybe_unused]] size_t const otherTop =
+      addCutOnPath(edges[entering].to, edges[entering].from, cut, false);
+    assert(top == otherTop);
+    inTree[leaving] = false;
+    inTree[entering] = true;
+    cutValue[entering] = -cut;
+    numberSubtree(top, low[top]);
+  }
+
+  /// Adds the cut of the leaving edge to the cut values of the tree edges from n up to
+  /// the first node above `end`, with the sign given by the edge direction and `fromTail`.
+  /// Returns that node.
+  size_t addCutOnPath(size_t n, size_t end, long cut, bool fromTail) {
+    while (!inSubtree(end, n)) {
+      size_t const e = parentEdge[n];
+      cutValue[e] += (edges[e].from == n) == fromTail ? cut : -cut;
+      n = parent[n];
+    }
+    return n;
+  }
+
+  [[maybe_unused]] bool matchesRebuiltTree() const {
+    MinimumSpanRanking rebuilt = *this;
+    rebuilt.numberTrees();
+    for (size_t e = 0; e < edges.size(); ++e) {
+      if (inTree[e] && (slack(e) != 0 || rebuilt.cutValue[e] != cutValue[e])) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  /// A tree edge with a negative cut value, looking from the edge `start` on, cyclically
+  std::optional<size_t> findNegativeCut(size_t start) const {
+    for (size_t i = 0; i < edges.size(); ++i) {
+      size_t e = (start + i) % edges.size();
+      if (!inTree[e]) {
+        continue;
+      }
+      if (cutValue[e] < 0) {
+        return e;
+      }
+    }
+    return std::nullopt;
+  }
+
+  /// The least slack edge that reconnects the two parts of the tree without the leaving edge,
+  /// pointing the same way as it
+  size_t findEnteringEdge(size_t leaving) const {
+    size_t tail = edges[leaving].from;
+    size_t head = edges[leaving].to;
+    bool const headBelow = lim[tail] > lim[head];
+    size_t const subtreeRoot = headBelow ? head : tail;
+    std::optional<size_t> ret;
+    for (size_t e = 0; e < edges.size(); ++e) {
+      if (headBelow == inSubtree(edges[e].from, subtreeRoot)
+          && headBelow != inSubtree(edges[e].to, subtreeRoot)
+          && (!ret || slack(e) < slack(*ret))) {
+        ret = e;
+      }
+    }
+    assert(ret && "The leaving edge itself crosses the cut");
+    return *ret;
+  }
+
+  Vec<long> rank;
+  Vec<Edge> edges;
+  Vec2<size_t> incident;
+  Vec<bool> inTree;
+  /// Tree structure, indexed by node: the edge to the parent, the postorder number (lim),
+  /// the smallest postorder number in the subtree (low) and the root of the tree
+  Vec<size_t> parent;
+  Vec<size_t> parentEdge;
+  Vec<size_t> low;
+  Vec<size_t> lim;
+  Vec<size_t> treeRoot;
+  /// The nodes by postorder number, so every subtree is a contiguous range
+  Vec<size_t> postorder;
+  /// Indexed by edge, meaningful for the tree edges
+  Vec<long> cutValue;
+};
+
+template <typename Ids>
+void replace(Ids& values, size_t dated, size_t updated) {
   for (auto& v : values) {
     if (v == dated) {
       v = updated;
@@ -74,16 +469,15 @@ void replace(Vec<size_t>& values, size_t dated, size_t updated) {
 }
 
 [[maybe_unused]]
-bool wellLayered(DAG const& dag, Vec2<size_t> const& layers) {
+bool wellLayered(GraphIndex const& index, Layering const& layers) {
   for (size_t layerI = 0; layerI < layers.size(); ++layerI) {
     for (size_t n : layers[layerI]) {
-      if (!dag.nodes[n].succs.empty() && layerI + 1 == layers.size()) {
+      if (!index.succs(n).empty() && layerI + 1 == layers.size()) {
         std::cout <<"node " <<n <<" has successors but is in the last layer\n";
         return false;
       }
-      for (size_t succ : dag.nodes[n].succs) {
-        if (std::find(layers[layerI + 1].begin(), layers[layerI + 1].end(), succ)
-            == layers[layerI + 1].end()) {
+      for (size_t succ : index.succs(n)) {
+        if (!layers.contains(succ) || layers.layerOf(succ) != layerI + 1) {
           std::cout <<"node " <<n <<" has successor " <<succ <<" not in the next layer\n";
           return false;
         }
@@ -93,34 +487,21 @@ bool wellLayered(DAG const& dag, Vec2<size_t> const& layers) {
   return true;
 }
 
-void sortSuccsAsLayers(DAG& dag, Vec2<size_t> const& layers) {
-  size_t const N = dag.nodes.size();
-  Vec<size_t> pos(N, 0);
-  for (auto layer : layers) {
-    for (size_t nodeI = 0; nodeI < layer.size(); ++nodeI) {
-      pos[layer[nodeI]] = nodeI;
-    }
-  }
-  for (auto& node : dag.nodes) {
-    std::sort(node.succs.begin(), node.succs.end(), [&pos](size_t n1, size_t n2) {
-      return pos[n1] < pos[n2];
-    });
-  }
+void sortSuccsAsLayers(GraphIndex& index, Layering const& layers) {
+  index.sortSuccs([&layers](size_t n1, size_t n2) { return layers.posOf(n1) < layers.posOf(n2); });
 }
 
 [[maybe_unused]]
-bool succsSameOrderAsLayers(DAG const& dag, Vec2<size_t> const& layers) {
+bool succsSameOrderAsLayers(GraphIndex const& index, Layering const& layers) {
   for (size_t layerI = 1; layerI < layers.size(); ++layerI) {
-    auto const& prevLayer = layers[layerI - 1];
-    auto const& curLayer = layers[layerI];
-    for (size_t nodeId : prevLayer) {
-      auto const& succs = dag.nodes[nodeId].succs;
+    for (size_t nodeId : layers[layerI - 1]) {
+      auto succs = index.succs(nodeId);
       for (size_t succI = 1; succI < succs.size(); ++succI) {
-        if (findIndex(curLayer, succs[succI - 1]) > findIndex(curLayer, succs[succI])) {
+        if (layers.posOf(succs[succI - 1]) > layers.posOf(succs[succI])) {
         std::cout
           << "for node" << nodeId << " succ " << succs[succI - 1] << " is at "
-          << findIndex(curLayer, succs[succI - 1]) << " and succ " << succs[succI] << " is at "
-          << findIndex(curLayer, succs[succI]) << "\n";
+          << layers.posOf(succs[succI - 1]) << " and succ " << succs[succI] << " is at "
+          << layers.posOf(succs[succI]) << "\n";
           return false;
         }
       }
@@ -129,62 +510,44 @@ bool succsSameOrderAsLayers(DAG const& dag, Vec2<size_t> const& layers) {
   return true;
 }
 
-std::optional<RenderError> insertEdgeWaypoints(DAG& dag, Vec2<size_t>& layers) {
-  size_t const preexistingCount = dag.nodes.size();
-  Vec<size_t> rank(preexistingCount, 0);
-  for (size_t layerI = 0; layerI < layers.size(); ++layerI) {
-    for (size_t n : layers[layerI]) {
-      rank[n] = layerI;
-    }
-  }
+/// Splits every edge spanning several layers into a chain of waypoints, one per layer crossed
+std::optional<RenderError> insertEdgeWaypoints(GraphIndex& index, Layering& layers) {
+  size_t const preexistingCount = index.size();
   for (size_t layerI = 0; layerI < layers.size(); ++layerI) {
     for (size_t n : layers[layerI]) {
       if (preexistingCount <= n) {
         // This is a waypoint that by construction has its edge targeting the next layer
-        assert(dag.nodes[n].succs.size() == 1);
+        assert(index.succs(n).size() == 1);
         assert(
-          preexistingCount <= dag.nodes[n].succs[0] || rank[dag.nodes[n].succs[0]] == layerI + 1
+          preexistingCount <= index.succs(n)[0]
+          || layers.layerOf(index.succs(n)[0]) == layerI + 1
         );
         continue;
       }
-      for (size_t& e : dag.nodes[n].succs) {
-        assert(layerI < rank[e]);
-        if (layerI + 1 == rank[e]) {
-          continue;
+      // Adding waypoints invalidates the successor lists, so they are looked up anew
+      for (size_t succI = 0; succI < index.succs(n).size(); ++succI) {
+        size_t finalSucc = index.succs(n)[succI];
+        assert(layerI < layers.layerOf(finalSucc));
+        size_t lastNode = n;
+        for (auto l = layerI + 1; l < layers.layerOf(finalSucc); ++l) {
+          size_t nodeId = index.addNode(NodeKind::Waypoint, {1, 1}, {finalSucc});
+          index.addPred(nodeId, lastNode);
+          index.replaceSucc(lastNode, finalSucc, nodeId);
+          layers.appendNode(l, nodeId);
+          lastNode = nodeId;
         }
-        size_t finalSucc = e;
-        size_t* lastEdge = &e;
-        for (auto l = layerI + 1; l < rank[finalSucc]; ++l) {
-          size_t nodeId = dag.nodes.size();
-          *lastEdge = nodeId;
-          dag.nodes.push_back({{0}, waypointText});
-          layers[l].push_back(nodeId);
-          lastEdge = &dag.nodes.back().succs.back();
-          // No need to add it to rank
+        if (lastNode != n) {
+          index.replacePred(finalSucc, n, lastNode);
         }
-        *lastEdge = finalSucc;
       }
     }
   }
-  sortSuccsAsLayers(dag, layers);
-  assert(wellLayered(dag, layers));
-  assert(succsSameOrderAsLayers(dag, layers));
+  sortSuccsAsLayers(index, layers);
+  assert(wellLayered(index, layers));
+  assert(succsSameOrderAsLayers(index, layers));
   return {};
 }
 
-struct SimpleEdge {
-  size_t from;
-  size_t to;
-
-  bool operator==(SimpleEdge const& other) const {
-    return std::tie(from, to) == std::tie(other.from, other.to);
-  }
-};
-
-struct SimpleEdgeHash {
-  size_t operator()(SimpleEdge const& e) const noexcept { return e.from ^ (e.to << 1); }
-};
-
 template<class Collection, class elem>
 bool contains(Collection const& cont, elem el) {
   return std::find(std::begin(cont), std::end(cont), el) != std::end(cont);
@@ -198,17 +561,15 @@ operator<<(std::ostream& os, CrossingPair const& crossing) {
       << crossing.fromRight << ")";
 }
 
-size_t insertCrossNode(DAG& dag, CrossingPair const& crossing) {
+size_t insertCrossNode(GraphIndex& index, CrossingPair const& crossing) {
   LOG("inserting crossing " <<crossing <<"\n");
-  size_t fromLeftIdx = findIndex(dag.nodes[crossing.fromLeft].succs, crossing.toRight);
-  size_t fromRightIdx = findIndex(dag.nodes[crossing.fromRight].succs, crossing.toLeft);
-  size_t xid = dag.nodes.size();
-  dag.nodes.emplace_back();
-  dag.nodes[xid].text = "X";
-  dag.nodes[xid].succs.push_back(crossing.toLeft);
-  dag.nodes[xid].succs.push_back(crossing.toRight);
-  dag.nodes[crossing.fromLeft].succs[fromLeftIdx] = xid;
-  dag.nodes[crossing.fromRight].succs[fromRightIdx] = xid;
+  size_t xid = index.addNode(NodeKind::Cross, {1, 1}, {crossing.toLeft, crossing.toRight});
+  index.replaceSucc(crossing.fromLeft, crossing.toRight, xid);
+  index.replaceSucc(crossing.fromRight, crossing.toLeft, xid);
+  index.addPred(xid, crossing.fromLeft);
+  index.addPred(xid, crossing.fromRight);
+  index.replacePred(crossing.toRight, crossing.fromLeft, xid);
+  index.replacePred(crossing.toLeft, crossing.fromRight, xid);
   LOG("inserted " <<xid <<"\n");
   return xid;
 }
@@ -233,8 +594,8 @@ std::ostream& operator<<(std::ostream& os, std::pair<A, B> p) {
   return os << "(" << p.first << ", " << p.second << ")";
 }
 
-template <typename A>
-std::ostream& operator<<(std::ostream& os, Vec<A> v) {
+template <typename A, typename Alloc>
+std::ostream& operator<<(std::ostream& os, std::vector<A, Alloc> const& v) {
   os << "[";
   bool first = true;
   for (auto const& x : v) {
@@ -277,16 +638,6 @@ void add(std::set<T>& to, std::set<T> const& from) {
   }
 }
 
-template <typename K, typename V>
-std::optional<V> findAndEraseIf(std::unordered_map<K, V>& map, K const& k) {
-  std::optional<V> ret = std::nullopt;
-  if (auto iter = map.find(k); iter != map.end()) {
-    ret.emplace(std::move(iter->second));
-    map.erase(iter);
-  }
-  return ret;
-}
-
 template <typename K, typename V>
 V const* getIf(std::unordered_map<K, V> const& map, K const& k) {
   if (auto iter = map.find(k); iter != map.end()) {
@@ -308,15 +659,14 @@ std::ostream& operator<<(std::ostream& os, ConnToNode const& conn) {
   return os << edgeChar(conn.exitAngle) << edgeChar(conn.entryAngle) << conn.nId;
 }
 
-using EdgeMap = std::unordered_map<size_t, ConnToNode>;
-
 // Map from position to a node id, if any
 using NodeMap = Vec<std::optional<size_t>>;
 
 class EdgesInFlight {
 public:
 
-  Vec<ConnToNode> findNRemoveEdgesToNode(size_t col);
+  /// Replaces the contents of found with the edges that end at the node column col
+  void findNRemoveEdgesToNode(size_t col, Vec<ConnToNode>& found);
   std::optional<ConnToNode>
   findNRemoveEdgeToEdge(Direction dir, NodeMap const& prevNodes, size_t col);
   std::optional<ParseError> findDanglingEdge(size_t line) const;
@@ -325,11 +675,23 @@ public:
   std::optional<ParseError>
   updateOrError(std::optional<ConnToNode> fromNode, Direction dir, Position const& pos);
 
-private:
+  /// Forget all edges, keeping the storage for the next line
+  void clear();
 
-  /// edges[0] stores an empty map (just for padding)
-  /// The edges[1]..edges[3] corresponds to the Direction options
-  std::array<EdgeMap, 4> edges;
+private:
+  using Word = std::uint64_t;
+  static constexpr size_t wordBits = 64;
+
+  bool has(int dir, size_t col) const;
+  std::optional<ConnToNode> take(int dir, size_t col);
+  std::optional<size_t> firstCol(int dir) const;
+
+  /// bits[0] stays empty (just for padding)
+  /// The bits[1]..bits[3] mark the columns with an edge in the corresponding Direction
+  std::array<Vec<Word>, 4> bits;
+  /// Source of the edge at every marked column,
+  /// a column holds a single edge character so the directions can share it
+  Vec<ConnToNode> sources;
 };
 
 std::optional<Direction> edgeChar(char c) {
@@ -362,10 +724,48 @@ int toInt(Direction dir) {
   return static_cast<int>(dir);
 }
 
+bool EdgesInFlight::has(int dir, size_t col) const {
+  auto const& words = bits[dir];
+  return col / wordBits < words.size() && (words[col / wordBits] >> (col % wordBits) & 1U);
+}
+
+std::optional<ConnToNode> EdgesInFlight::take(int dir, size_t col) {
+  if (!has(dir, col)) {
+    return std::nullopt;
+  }
+  bits[dir][col / wordBits] &= ~(Word{1} << (col % wordBits));
+  return sources[col];
+}
+
+std::optional<size_t> EdgesInFlight::firstCol(int dir) const {
+  auto const& words = bits[dir];
+  for (size_t w = 0; w < words.size(); ++w) {
+    if (words[w] != 0) {
+      return w * wordBits + static_cast<size_t>(__builtin_ctzll(words[w]));
+    }
+  }
+  return std::nullopt;
+}
+
+void EdgesInFlight::clear() {
+  for (auto& words : bits) {
+    std::fill(words.begin(), words.end(), 0);
+  }
+}
+
 std::optional<ParseError> EdgesInFlight::
   updateOrError(std::optional<ConnToNode> fromNodes, Direction dir, Position const& pos) {
   if (fromNodes) {
-    edges[toInt(dir)][pos.col] = *fromNodes;
+    auto& words = bits[toInt(dir)];
+    if (words.size() <= pos.col / wordBits) {
+      words.resize(pos.col / wordBits + 1, 0);
+    }
+    if (sources.size() <= pos.col) {
+      sources.resize(pos.col + 1);
+    }
+    assert(!has(toInt(dir), pos.col));
+    words[pos.col / wordBits] |= Word{1} << (pos.col % wordBits);
+    sources[pos.col] = *fromNodes;
     return {};
   }
   return ParseError{
@@ -383,14 +783,13 @@ static std::array<std::array<int, /* line above */ 4>, /* line below */ 4> const
   {-1, 0, 0, -1} // no format
 }};
 
-Vec<ConnToNode> EdgesInFlight::findNRemoveEdgesToNode(size_t col) {
-  Vec<ConnToNode> ret;
+void EdgesInFlight::findNRemoveEdgesToNode(size_t col, Vec<ConnToNode>& found) {
+  found.clear();
   for (auto dir : {toInt(Direction::Left), toInt(Direction::Straight), toInt(Direction::Right)}) {
-    if (auto to = findAndEraseIf(edges[dir], col + columnShift[dir][0])) {
-      ret.emplace_back(*to);
+    if (auto to = take(dir, col + columnShift[dir][0])) {
+      found.emplace_back(*to);
     }
   }
-  return ret;
 }
 
 std::optional<ConnToNode>
@@ -399,7 +798,7 @@ EdgesInFlight::findNRemoveEdgeToEdge(Direction dirBelow, NodeMap const& prevNode
   // from left to right, i.e., \(Right), |(Straight), /(Left)
   for (auto dirAbove :
        {toInt(Direction::Right), toInt(Direction::Straight), toInt(Direction::Left)}) {
-    if (auto from = findAndEraseIf(edges[dirAbove], col + columnShift[dirAbove][toInt(dirBelow)])) {
+    if (auto from = take(dirAbove, col + columnShift[dirAbove][toInt(dirBelow)])) {
       from->entryAngle = dirBelow;
       return *from;
     }
@@ -417,7 +816,13 @@ std::ostream&
 operator<<(std::ostream& os, EdgesInFlight const& edges) {
   bool first = true;
   for (auto dir : {Direction::Left, Direction::Straight, Direction::Right}) {
-    os << edgeChar(dir) << ' ' << edges.edges[toInt(dir)];
+    os << edgeChar(dir) << " {";
+    for (size_t col = 0; col < edges.sources.size(); ++col) {
+      if (edges.has(toInt(dir), col)) {
+        os << ' ' << col << " -> " << edges.sources[col];
+      }
+    }
+    os << " }";
     if (!first) {
       os << ' ';
     }
@@ -430,14 +835,13 @@ std::optional<ParseError> EdgesInFlight::findDanglingEdge(size_t line) const {
   std::optional<ParseError> ret;
 
   for (auto dir : {Direction::Left, Direction::Straight, Direction::Right}) {
-    for (auto const& [col, src] : edges[toInt(dir)]) {
-      if (!ret || col < ret->pos.col) {
-        ret = ParseError{
-          ParseError::Code::DanglingEdge,
-          "Dangling edge "s + edgeChar(dir) + " from " + std::to_string(src.nId),
-          {line, col}
-        };
-      }
+    auto col = firstCol(toInt(dir));
+    if (col && (!ret || *col < ret->pos.col)) {
+      ret = ParseError{
+        ParseError::Code::DanglingEdge,
+        "Dangling edge "s + edgeChar(dir) + " from " + std::to_string(sources[*col].nId),
+        {line, *col}
+      };
     }
   }
   return ret;
@@ -445,9 +849,8 @@ std::optional<ParseError> EdgesInFlight::findDanglingEdge(size_t line) const {
 
 class NodeCollector {
 public:
-  NodeCollector(size_t maxWidth) : prevNodes(maxWidth + 1), currNodes(maxWidth + 1) {
-    // Allocate 1 extra because columns are counted from 1
-  }
+  /// Without keepText only the label rectangles are tracked, not their contents
+  explicit NodeCollector(bool keepText) : keepText(keepText) {}
 
   struct Edge {
     size_t fromNode;
@@ -459,6 +862,8 @@ public:
   struct Node {
     string text;
     Position pos;
+    LabelRect label;
+    NodeKind kind;
     Vec<size_t> succEdges;
     Vec<size_t> predEdges;
   };
@@ -466,17 +871,28 @@ public:
   std::optional<ParseError> tryAddNode(EdgesInFlight& prevEdges, Position const& pos);
 
   void addNodeChar(char c) { partialNode.push_back(c); }
+  void addNodeChars(string_view chars) { partialNode.append(chars); }
+
+  bool hasPartialNode() const { return !partialNode.empty(); }
 
   bool isPartOfANode(size_t col) const;
 
   DAG buildDAG() &&;
+  SourceDAG buildSourceDAG(string_view source) &&;
+  std::optional<CompactDAG> buildCompactDAG(string_view source, ParseError& err) &&;
 
   NodeMap const& getPrevNodes() const { return prevNodes; }
 
+  /// Make sure columns up to and including col can be looked up in both lines
+  void fitColumn(size_t col);
+
   void newLine();
 
   std::optional<ParseError> finalize();
 
+  /// Forget the parsed nodes and edges, keeping the storage for the next input
+  void reset(bool keepText);
+
 private:
   std::optional<ParseError> checkRectangularNewNode(Position const& pos);
   void startNewNode(EdgesInFlight& prevEdges, Position const& pos);
@@ -492,16 +908,102 @@ private:
   string partialNode = "";
   NodeMap prevNodes;
   NodeMap currNodes;
+  /// Column ranges [first, last) filled in prevNodes/currNodes,
+  /// so that a line is cleared without touching the gaps between the nodes
+  Vec<std::pair<size_t, size_t>> prevNodeSpans;
+  Vec<std::pair<size_t, size_t>> currNodeSpans;
+  /// Edges ending at the node being added, reused across nodes
+  Vec<ConnToNode> arrivingEdges;
+  bool keepText;
   bool finalized = false;
 };
 
+std::vector<size_t> findLineStarts(string_view source) {
+  std::vector<size_t> ret;
+  for (size_t i = 0; i < source.size(); ++i) {
+    if (i == 0 || source[i - 1] == '\n') {
+      ret.push_back(i);
+    }
+  }
+  return ret;
+}
+
+void appendLabel(
+  string& out,
+  string_view source,
+  std::vector<size_t> const& lineStarts,
+  LabelRect const& label
+) {
+  for (size_t row = 0; row < label.height; ++row) {
+    if (row != 0) {
+      out.push_back('\n');
+    }
+    out.append(source.substr(lineStarts[label.topLeft.line + row] + label.topLeft.col, label.width));
+  }
+}
+
+std::optional<CompactDAG> NodeCollector::buildCompactDAG(string_view source, ParseError& err) && {
+  using Id = CompactDAG::Id;
+  size_t labelBytes = 0;
+  for (auto const& node : nodes) {
+    // The rows of a label are joined with new-lines
+    labelBytes += node.label.height * (node.label.width + 1) - (0 < node.label.height);
+  }
+  if (auto overflow = detail::compactDAGOverflow(nodes.size(), edges.size(), labelBytes)) {
+    err = ParseError{ParseError::Code::TooLarge, *overflow, {0, 0}};
+    return std::nullopt;
+  }
+  auto const lineStarts = findLineStarts(source);
+  std::vector<Id> succOffsets;
+  std::vector<Id> succTargets;
+  string labels;
+  std::vector<Id> labelOffsets;
+  succOffsets.reserve(nodes.size() + 1);
+  succTargets.reserve(edges.size());
+  labelOffsets.reserve(nodes.size() + 1);
+  for (auto const& node : nodes) {
+    succOffsets.push_back(static_cast<Id>(succTargets.size()));
+    for (auto const& edgeId : node.succEdges) {
+      succTargets.push_back(static_cast<Id>(edges[edgeId].toNode));
+    }
+    labelOffsets.push_back(static_cast<Id>(labels.size()));
+    appendLabel(labels, source, lineStarts, node.label);
+  }
+  succOffsets.push_back(static_cast<Id>(succTargets.size()));
+  labelOffsets.push_back(static_cast<Id>(labels.size()));
+  return CompactDAG::fromCSR(
+    std::move(succOffsets),
+    std::move(succTargets),
+    std::move(labels),
+    std::move(labelOffsets)
+  );
+}
+
+SourceDAG NodeCollector::buildSourceDAG(string_view source) && {
+  SourceDAG ret;
+  ret.source = source;
+  ret.lineStarts = findLineStarts(source);
+  ret.nodes.reserve(nodes.size());
+  for (auto const& node : nodes) {
+    ret.nodes.emplace_back();
+    ret.nodes.back().label = node.label;
+    auto& succs = ret.nodes.back().succs;
+    for (auto const& edgeId : node.succEdges) {
+      succs.push_back(edges[edgeId].toNode);
+    }
+  }
+  return ret;
+}
+
 DAG NodeCollector::buildDAG() && {
+  assert(keepText);
   DAG ret;
   ret.nodes.reserve(nodes.size());
   for (auto&& node : nodes) {
     ret.nodes.emplace_back();
     ret.nodes.back().text = std::move(node.text);
     auto& succs = ret.nodes.back().succs;
+    succs.reserve(node.succEdges.size());
     for (auto const& edgeId : node.succEdges) {
       succs.push_back(edges[edgeId].toNode);
     }
@@ -510,12 +1012,12 @@ DAG NodeCollector::buildDAG() && {
 }
 
 bool hasCrossEdges(Vec<NodeCollector::Node> const& nodes) {
-  return std::any_of(nodes.begin(), nodes.end(), [](auto const& n) { return n.text == "X"; });
+  return std::any_of(nodes.begin(), nodes.end(), [](auto const& n) { return n.kind == NodeKind::Cross; });
 }
 
 std::optional<ParseError> validateEdgeCrossings(Vec<NodeCollector::Node> const& nodes) {
   for (auto const& node : nodes) {
-    if (node.text == "X") {
+    if (node.kind == NodeKind::Cross) {
       auto nPreds = node.predEdges.size();
       auto nSuccs = node.succEdges.size();
       if (nPreds < 2 || nPreds < nSuccs) {
@@ -637,7 +1139,7 @@ void removeXnodes(Vec<NodeCollector::Node>& nodes, Vec<NodeCollector::Edge>& edg
   size_t nSkipped = 0;
   Vec<size_t> nodeIdMap(nodes.size());
   for (size_t i = 0; i < nodes.size(); ++i) {
-    if (nodes[i].text == "X") {
+    if (nodes[i].kind == NodeKind::Cross) {
       ++nSkipped;
     }
     nodeIdMap[i] = i - nSkipped;
@@ -647,14 +1149,14 @@ void removeXnodes(Vec<NodeCollector::Node>& nodes, Vec<NodeCollector::Edge>& edg
     edge.toNode = nodeIdMap[edge.toNode];
   }
   nodes.erase(
-    std::remove_if(nodes.begin(), nodes.end(), [](auto const& n) { return n.text == "X"; }),
+    std::remove_if(nodes.begin(), nodes.end(), [](auto const& n) { return n.kind == NodeKind::Cross; }),
     nodes.end()
   );
 }
 
 void NodeCollector::resolveCrossEdges() {
   for (auto const& node : nodes) {
-    if (node.text == "X") {
+    if (node.kind == NodeKind::Cross) {
       // Assertions are ensured by "validateEdgeCrossings"
       size_t nPreds = node.predEdges.size();
       assert(2 <= nPreds);
@@ -682,6 +1184,18 @@ std::optional<ParseError> NodeCollector::finalize() {
   return {};
 }
 
+void NodeCollector::reset(bool keepTextOfNodes) {
+  nodes.clear();
+  edges.clear();
+  partialNode.clear();
+  std::fill(prevNodes.begin(), prevNodes.end(), std::nullopt);
+  std::fill(currNodes.begin(), currNodes.end(), std::nullopt);
+  prevNodeSpans.clear();
+  currNodeSpans.clear();
+  keepText = keepTextOfNodes;
+  finalized = false;
+}
+
 std::optional<ParseError> NodeCollector::tryAddNode(EdgesInFlight& prevEdges, Position const& pos) {
   if (partialNode.empty()) {
     return {};
@@ -704,9 +1218,21 @@ bool NodeCollector::isPartOfANode(size_t col) const {
   return !partialNode.empty() && prevNodes[col - 1].has_value() && prevNodes[col].has_value() != 0;
 }
 
+void NodeCollector::fitColumn(size_t col) {
+  if (prevNodes.size() <= col) {
+    prevNodes.resize(col + 1);
+    currNodes.resize(col + 1);
+  }
+}
+
 void NodeCollector::newLine() {
-  prevNodes = std::move(currNodes);
-  currNodes = NodeMap(prevNodes.size());
+  std::swap(prevNodes, currNodes);
+  std::swap(prevNodeSpans, currNodeSpans);
+  for (auto [first, last] : currNodeSpans) {
+    std::fill(currNodes.begin() + first, currNodes.begin() + last, std::nullopt);
+  }
+  currNodeSpans.clear();
+  assert(std::none_of(currNodes.begin(), currNodes.end(), [](auto n) { return n.has_value(); }));
 }
 
 std::optional<ParseError> NodeCollector::checkRectangularNewNode(Position const& pos) {
@@ -732,14 +1258,22 @@ void NodeCollector::addEdge(NodeCollector::Edge&& e) {
 void NodeCollector::startNewNode(EdgesInFlight& prevEdges, Position const& pos) {
   size_t id = nodes.size();
   nodes.emplace_back();
-  nodes[id].text = partialNode;
+  if (keepText) {
+    nodes[id].text = partialNode;
+  }
   nodes[id].pos = pos;
+  // Columns are counted from 1, and pos is just past the node
+  nodes[id].label = {{pos.line, pos.col - 1 - partialNode.size()}, partialNode.size(), 1};
+  // "X" is the crossing syntax, there is no way to spell a node labelled X
+  nodes[id].kind = partialNode == "X" ? NodeKind::Cross : NodeKind::Regular;
   for (size_t p = pos.col - partialNode.size(); p < pos.col; ++p) {
-    for (auto from : prevEdges.findNRemoveEdgesToNode(p)) {
+    prevEdges.findNRemoveEdgesToNode(p, arrivingEdges);
+    for (auto from : arrivingEdges) {
       addEdge({from.nId, from.exitAngle, id, from.entryAngle});
     }
     currNodes[p] = id;
   }
+  currNodeSpans.emplace_back(pos.col - partialNode.size(), pos.col);
   partialNode.clear();
 }
 
@@ -781,15 +1315,22 @@ void NodeCollector::addNodeLine(size_t nodeAbove, EdgesInFlight& prevEdges, Posi
   for (size_t p = pos.col - partialNode.size(); p < pos.col; ++p) {
     currNodes[p] = nodeAbove;
   }
-  for (auto edge : prevEdges.findNRemoveEdgesToNode(pos.col - partialNode.size())) {
+  currNodeSpans.emplace_back(pos.col - partialNode.size(), pos.col);
+  prevEdges.findNRemoveEdgesToNode(pos.col - partialNode.size(), arrivingEdges);
+  for (auto edge : arrivingEdges) {
     assert(partialNode.size() == 1 || edge.entryAngle == Direction::Right);
     addEdge({edge.nId, edge.exitAngle, nodeAbove, edge.entryAngle});
   }
-  for (auto edge : prevEdges.findNRemoveEdgesToNode(pos.col - 1)) {
+  prevEdges.findNRemoveEdgesToNode(pos.col - 1, arrivingEdges);
+  for (auto edge : arrivingEdges) {
     assert(partialNode.size() == 1 || edge.entryAngle == Direction::Left);
     addEdge({edge.nId, edge.exitAngle, nodeAbove, edge.entryAngle});
   }
-  nodes[nodeAbove].text += "\n" + partialNode;
+  if (keepText) {
+    nodes[nodeAbove].text.append(1, '\n').append(partialNode);
+  }
+  ++nodes[nodeAbove].label.height;
+  nodes[nodeAbove].kind = NodeKind::Regular;
   partialNode.clear();
 }
 
@@ -810,8 +1351,14 @@ struct Connectivity {
     bool bottomRight = false;
   };
 
+  /// Indexed by edge id, the ids are stable across updates
   Vec<Edge> edges;
   Vec<Valency> nodeValencies;
+  /// Ids of the outgoing and incoming edges of every node
+  Vec2<size_t> succEdges;
+  Vec2<size_t> predEdges;
+  /// Edge ids sorted with compareEdges, the order in which the edges are drawn
+  Vec<size_t> order;
 };
 
 size_t absDiff(size_t a, size_t b) {
@@ -1073,27 +1620,26 @@ void setEntryForRegularNode(
   setEntryForNodesOnTheRight(conn, nodeId, edgeIds, attachedEdges, rightMostOffset);
 }
 
-void setEdgeEntryParameters(
+void setNodeEntryParameters(
   Connectivity& conn,
-  Vec2<size_t> const& predEdges,
+  size_t nodeId,
   Vec<Position> const& coords,
-  DAG const& dag,
-  Vec<Position> const& dimensions
+  GraphIndex const& index
 ) {
-  for (size_t i = 0; i < predEdges.size(); ++i) {
-    auto edgeIds = sortEdgeIdsPredsLeftToRight(predEdges[i], conn, coords);
-    if (edgeIds.empty()) {
-      continue;
-    }
-    if (dag.nodes[i].text == waypointText) {
+  auto edgeIds = sortEdgeIdsPredsLeftToRight(conn.predEdges[nodeId], conn, coords);
+  if (edgeIds.empty()) {
+    return;
+  }
+  switch (index.kind(nodeId)) {
+    case NodeKind::Waypoint:
       setEntryForWaypoint(conn, edgeIds);
-      continue;
-    }
-    if (dag.nodes[i].text == "X") {
-      setEntryForCrossNode(conn, i, edgeIds);
-      continue;
-    }
-    setEntryForRegularNode(conn, i, edgeIds, coords, dimensions);
+      break;
+    case NodeKind::Cross:
+      setEntryForCrossNode(conn, nodeId, edgeIds);
+      break;
+    case NodeKind::Regular:
+      setEntryForRegularNode(conn, nodeId, edgeIds, coords, index.dimensions());
+      break;
   }
 }
 
@@ -1244,27 +1790,26 @@ Vec<size_t> sortEdgeIdsSuccsLeftToRight(
   return edgeIds;
 }
 
-void setEdgeExitParameters(
+void setNodeExitParameters(
   Connectivity& conn,
-  Vec2<size_t> const& succEdges,
+  size_t nodeId,
   Vec<Position> const& coords,
-  DAG const& dag,
-  Vec<Position> const& dimensions
+  GraphIndex const& index
 ) {
-  for (size_t i = 0; i < succEdges.size(); ++i) {
-    auto edgeIds = sortEdgeIdsSuccsLeftToRight(succEdges[i], conn, coords);
-    if (edgeIds.empty()) {
-      continue;
-    }
-    if (dag.nodes[i].text == waypointText) {
+  auto edgeIds = sortEdgeIdsSuccsLeftToRight(conn.succEdges[nodeId], conn, coords);
+  if (edgeIds.empty()) {
+    return;
+  }
+  switch (index.kind(nodeId)) {
+    case NodeKind::Waypoint:
       setExitForWaypoint(conn, edgeIds);
-      continue;
-    }
-    if (dag.nodes[i].text == "X") {
-      setExitForCrossNode(conn, i, edgeIds);
-      continue;
-    }
-    setExitForRegularNode(conn, i, edgeIds, coords, dimensions);
+      break;
+    case NodeKind::Cross:
+      setExitForCrossNode(conn, nodeId, edgeIds);
+      break;
+    case NodeKind::Regular:
+      setExitForRegularNode(conn, nodeId, edgeIds, coords, index.dimensions());
+      break;
   }
 }
 
@@ -1289,77 +1834,721 @@ bool compareEdges(
 }
 
 Connectivity
-computeConnectivity(DAG const& dag, Vec<Position> const& coords, Vec<Position> const& dimensions) {
-  size_t const N = dag.nodes.size();
-  Vec2<size_t> preds(N);
-  Vec2<size_t> predEdges(N);
-  Vec2<size_t> succEdges(N);
+computeConnectivity(GraphIndex const& index, Vec<Position> const& coords) {
+  size_t const N = index.size();
   Connectivity ret;
   ret.nodeValencies.resize(N);
+  ret.predEdges.resize(N);
+  ret.succEdges.resize(N);
   for (size_t i = 0; i < N; ++i) {
-    for (size_t e : dag.nodes[i].succs) {
-      preds[e].push_back(i);
+    for (size_t e : index.succs(i)) {
       size_t edgeId = ret.edges.size();
-      predEdges[e].push_back(edgeId);
-      succEdges[i].push_back(edgeId);
+      ret.predEdges[e].push_back(edgeId);
+      ret.succEdges[i].push_back(edgeId);
       // The angles are not correct there yet
       ret.edges.push_back({i, 0, e, 0, Direction::Straight, Direction::Straight});
     }
   }
+  [[maybe_unused]] auto const& dimensions = index.dimensions();
   for (auto& edge : ret.edges) {
-    assert(dag.nodes[edge.from].succs.size() <= dimensions[edge.from].col + 2 && "Overcrowded node");
-    assert(preds[edge.to].size() <= dimensions[edge.to].col + 2 && "Overcrowded node");
-    assert(1 <= dag.nodes[edge.from].succs.size() && "Fanthom edge");
-    assert(1 <= preds[edge.to].size() && "Fanthom edge");
-  }
-  setEdgeExitParameters(ret, succEdges, coords, dag, dimensions);
-  setEdgeEntryParameters(ret, predEdges, coords, dag, dimensions);
-  std::sort(ret.edges.begin(), ret.edges.end(), [&coords](auto const& a, auto const& b) {
-    return compareEdges(coords, a, b);
+    assert(index.succs(edge.from).size() <= dimensions[edge.from].col + 2 && "Overcrowded node");
+    assert(index.preds(edge.to).size() <= dimensions[edge.to].col + 2 && "Overcrowded node");
+    assert(1 <= index.succs(edge.from).size() && "Fanthom edge");
+    assert(index.preds(edge.to).size() == ret.predEdges[edge.to].size() && "Stale index");
+  }
+  for (size_t i = 0; i < N; ++i) {
+    setNodeExitParameters(ret, i, coords, index);
+  }
+  for (size_t i = 0; i < N; ++i) {
+    setNodeEntryParameters(ret, i, coords, index);
+  }
+  ret.order.resize(ret.edges.size());
+  std::iota(ret.order.begin(), ret.order.end(), 0);
+  std::sort(ret.order.begin(), ret.order.end(), [&coords, &ret](size_t a, size_t b) {
+    return compareEdges(coords, ret.edges[a], ret.edges[b]);
   });
   return ret;
 }
 
-Vec<Position> computeNodeCoordinates(DAG const& dag, Vec2<size_t> const& layers, Vec<Position> const& dimensions) {
-  Vec<Position> ret(dag.nodes.size(), Position{0, 0});
-  size_t line = 0;
-  for (auto const& layer : layers) {
-    size_t col = 0;
-    size_t maxLine = 0;
-    for (size_t n : layer) {
-      ret[n].col = col;
-      ret[n].line = line;
-      // 1 for space
-      col += 1 + dimensions[n].col;
-      maxLine = std::max(maxLine, dimensions[n].line);
+/// Brings conn up to date after the columns of movedNodes changed.
+/// Only the nodes next to a moved one can attach their edges differently,
+/// so only their edges get new parameters and a new place in the drawing order.
+void updateConnectivity(
+  Connectivity& conn,
+  GraphIndex const& index,
+  Vec<Position> const& coords,
+  Vec<size_t> const& movedNodes
+) {
+  Vec<bool> staleNodes(index.size(), false);
+  for (size_t n : movedNodes) {
+    staleNodes[n] = true;
+    for (size_t pred : index.preds(n)) {
+      staleNodes[pred] = true;
+    }
+    for (size_t succ : index.succs(n)) {
+      staleNodes[succ] = true;
     }
-    line += maxLine + 1;
   }
-  return ret;
-}
-
-Vec2<size_t> groupEdgesByLayer(Connectivity const& conn, Vec2<size_t> const& layers) {
-  size_t const N = conn.nodeValencies.size();
-  Vec2<size_t> ret(layers.size());
-  Vec<size_t> nodeLayer(N);
-  for (size_t i = 0; i < layers.size(); ++i) {
-    for (auto n : layers[i]) {
-      nodeLayer[n] = i;
+  Vec<bool> staleEdges(conn.edges.size(), false);
+  for (size_t n = 0; n < staleNodes.size(); ++n) {
+    if (!staleNodes[n]) {
+      continue;
+    }
+    // Exit and entry parameters both set flags on either side of the node
+    conn.nodeValencies[n] = {};
+    for (size_t e : conn.succEdges[n]) {
+      staleEdges[e] = true;
+    }
+    for (size_t e : conn.predEdges[n]) {
+      staleEdges[e] = true;
+    }
+  }
+  for (size_t n = 0; n < staleNodes.size(); ++n) {
+    if (staleNodes[n]) {
+      setNodeExitParameters(conn, n, coords, index);
+    }
+  }
+  for (size_t n = 0; n < staleNodes.size(); ++n) {
+    if (staleNodes[n]) {
+      setNodeEntryParameters(conn, n, coords, index);
+    }
+  }
+
+  // Lines move by whole layers, so they never reorder the edges: only the stale edges can
+  auto compare = [&coords, &conn](size_t a, size_t b) {
+    return compareEdges(coords, conn.edges[a], conn.edges[b]);
+  };
+  Vec<size_t> kept;
+  Vec<size_t> reordered;
+  for (size_t e : conn.order) {
+    (staleEdges[e] ? reordered : kept).push_back(e);
+  }
+  std::sort(reordered.begin(), reordered.end(), compare);
+  conn.order.clear();
+  std::merge(
+    kept.begin(), kept.end(), reordered.begin(), reordered.end(), std::back_inserter(conn.order), compare
+  );
+}
+
+[[maybe_unused]] bool connectivityMatches(Connectivity const& conn, Connectivity const& fresh) {
+  auto sameEdge = [](Connectivity::Edge const& a, Connectivity::Edge const& b) {
+    return std::tie(a.from, a.exitOffset, a.to, a.entryOffset, a.exitAngle, a.entryAngle)
+      == std::tie(b.from, b.exitOffset, b.to, b.entryOffset, b.exitAngle, b.entryAngle);
+  };
+  auto sameValency = [](Connectivity::Valency const& a, Connectivity::Valency const& b) {
+    return std::tie(a.topLeft, a.topRight, a.bottomLeft, a.bottomRight)
+      == std::tie(b.topLeft, b.topRight, b.bottomLeft, b.bottomRight);
+  };
+  return std::equal(conn.edges.begin(), conn.edges.end(), fresh.edges.begin(), fresh.edges.end(), sameEdge)
+    && std::equal(
+      conn.nodeValencies.begin(), conn.nodeValencies.end(),
+      fresh.nodeValencies.begin(), fresh.nodeValencies.end(),
+      sameValency
+    );
+}
+
+/// Stacks the layers one right below the other
+void assignLayerLines(Vec<Position>& coords, Layering const& layers, Vec<Position> const& dimensions) {
+  size_t line = 0;
+  for (auto const& layer : layers) {
+    size_t maxLine = 0;
+    for (size_t n : layer) {
+      coords[n].line = line;
+      maxLine = std::max(maxLine, dimensions[n].line);
+    }
+    line += maxLine + 1;
+  }
+}
+
+Vec<Position> computeNodeCoordinates(Layering const& layers, Vec<Position> const& dimensions) {
+  Vec<Position> ret(dimensions.size(), Position{0, 0});
+  for (auto const& layer : layers) {
+    size_t col = 0;
+    for (size_t n : layer) {
+      ret[n].col = col;
+      // 1 for space
+      col += 1 + dimensions[n].col;
+    }
+  }
+  assignLayerLines(ret, layers, dimensions);
+  return ret;
+}
+
+/// Edge between two layout nodes, the kind of edge that would rather stay vertical
+bool isInnerSegment(GraphIndex const& index, size_t u, size_t v) {
+  return index.kind(u) != NodeKind::Regular && index.kind(v) != NodeKind::Regular;
+}
+
+bool hasLeftColumn(Connectivity::Valency const& valency) {
+  return valency.topLeft || valency.bottomLeft;
+}
+
+bool hasRightColumn(Connectivity::Valency const& valency) {
+  return valency.topRight || valency.bottomRight;
+}
+
+/// Marks the edges between two adjacent layers that cross an inner segment,
+/// so that the vertical alignment can leave them out (type 1 conflicts of Brandes and Köpf).
+/// The edge from v to adjacent[v][i] gets the flag firstEdge[v] + i.
+Vec<bool> findInnerSegmentConflicts(
+  Vec2<size_t> const& order,
+  Vec<size_t> const& pos,
+  Vec2<size_t> const& adjacent,
+  Vec<size_t> const& firstEdge,
+  GraphIndex const& index
+) {
+  Vec<bool> marked(firstEdge.back(), false);
+  for (size_t i = 1; i < order.size(); ++i) {
+    auto const& upper = order[i - 1];
+    auto const& lower = order[i];
+    size_t k0 = 0;
+    size_t l = 0;
+    for (size_t l1 = 0; l1 < lower.size(); ++l1) {
+      std::optional<size_t> innerNeighbor;
+      for (size_t u : adjacent[lower[l1]]) {
+        if (isInnerSegment(index, u, lower[l1])) {
+          innerNeighbor = u;
+        }
+      }
+      if (l1 + 1 != lower.size() && !innerNeighbor) {
+        continue;
+      }
+      size_t k1 = innerNeighbor ? pos[*innerNeighbor] : upper.size() - 1;
+      for (; l <= l1; ++l) {
+        auto const& linked = adjacent[lower[l]];
+        for (size_t j = 0; j < linked.size(); ++j) {
+          if (pos[linked[j]] < k0 || k1 < pos[linked[j]]) {
+            marked[firstEdge[lower[l]] + j] = true;
+          }
+        }
+      }
+      k0 = k1;
+    }
+  }
+  return marked;
+}
+
+/// Brandes-Köpf placement: balances the four alignments with upper and lower medians,
+/// packed to the left and to the right, so that edges run as straight as the order allows.
+/// Nodes are aligned by their centers.
+/// The columns are only targets: alignWithMedians moves the nodes of a settled layout
+/// towards them wherever that leaves room for the side edges.
+class MedianAlignedPlacement {
+public:
+  MedianAlignedPlacement(GraphIndex const& index, Layering const& layers)
+    : layers(layers), dimensions(index.dimensions()) {
+    size_t const nNodes = index.size();
+    // Visiting the layers in order lists the neighbors of every node left to right
+    Vec2<size_t> sortedPreds(nNodes);
+    Vec2<size_t> sortedSuccs(nNodes);
+    for (auto const& layer : layers) {
+      for (size_t n : layer) {
+        for (size_t succ : index.succs(n)) {
+          sortedPreds[succ].push_back(n);
+        }
+        for (size_t pred : index.preds(n)) {
+          sortedSuccs[pred].push_back(n);
+        }
+      }
+    }
+    std::array<Alignment, 4> alignments;
+    for (size_t variant = 0; variant < alignments.size(); ++variant) {
+      bool downward = variant < 2;
+      alignments[variant] =
+        alignMedians(downward ? sortedPreds : sortedSuccs, downward, variant % 2 == 0, index);
+    }
+    balance(alignments);
+  }
+
+  /// The column of every node in the balanced alignment, the leftmost at 0
+  long column(size_t n) const {
+    return balanced[n];
+  }
+
+  /// The columns the balanced alignment spans, with a space after every node
+  long width() const {
+    return balancedWidth;
+  }
+
+private:
+  static constexpr size_t none = std::numeric_limits<size_t>::max();
+
+  /// Every node chained to a median neighbor in the previous layer of the order,
+  /// the layers and the nodes in them taken downward or upward, leftward or rightward
+  struct Alignment {
+    bool leftward;
+    /// The top node of the block of every node
+    Vec<size_t> root;
+    /// The next node down the block, back to the root from the bottom one
+    Vec<size_t> align;
+    /// The neighbors of every node within its layer in the order, or none
+    Vec<size_t> before;
+    Vec<size_t> after;
+    /// The block roots, a block after all the blocks before any of its nodes
+    Vec<size_t> blockOrder;
+  };
+
+  /// adjacent lists the neighbors of every node in the previous layer of the order,
+  /// sorted left to right
+  Alignment alignMedians(
+    Vec2<size_t> const& adjacent,
+    bool downward,
+    bool leftward,
+    GraphIndex const& index
+  ) const {
+    size_t const nNodes = dimensions.size();
+    Vec2<size_t> order(layers.begin(), layers.end());
+    if (!downward) {
+      std::reverse(order.begin(), order.end());
+    }
+    Alignment ret;
+    ret.leftward = leftward;
+    ret.before.assign(nNodes, none);
+    ret.after.assign(nNodes, none);
+    Vec<size_t> pos(nNodes, 0);
+    for (auto& layer : order) {
+      if (!leftward) {
+        std::reverse(layer.begin(), layer.end());
+      }
+      for (size_t i = 0; i < layer.size(); ++i) {
+        pos[layer[i]] = i;
+        if (0 < i) {
+          ret.before[layer[i]] = layer[i - 1];
+          ret.after[layer[i - 1]] = layer[i];
+        }
+      }
+    }
+    Vec<size_t> firstEdge(nNodes + 1, 0);
+    for (size_t n = 0; n < nNodes; ++n) {
+      firstEdge[n + 1] = firstEdge[n] + adjacent[n].size();
+    }
+    auto const marked = findInnerSegmentConflicts(order, pos, adjacent, firstEdge, index);
+
+    // Vertical alignment: chain every node to a median neighbor unless that crosses
+    // an alignment already made in the same layer
+    ret.root.resize(nNodes);
+    ret.align.resize(nNodes);
+    std::iota(ret.root.begin(), ret.root.end(), 0);
+    std::iota(ret.align.begin(), ret.align.end(), 0);
+    for (size_t i = 1; i < order.size(); ++i) {
+      std::optional<size_t> lastAligned;
+      for (size_t v : order[i]) {
+        size_t const d = adjacent[v].size();
+        if (d == 0) {
+          continue;
+        }
+        for (size_t m : {(d - 1) / 2, d / 2}) {
+          // The m-th neighbor in the order of the layer
+          size_t slot = leftward ? m : d - 1 - m;
+          size_t u = adjacent[v][slot];
+          if (
+            ret.align[v] == v && !marked[firstEdge[v] + slot]
+            && (!lastAligned || *lastAligned < pos[u])
+          ) {
+            ret.align[u] = v;
+            ret.root[v] = ret.root[u];
+            ret.align[v] = ret.root[v];
+            lastAligned = pos[u];
+          }
+        }
+      }
+    }
+
+    // A block follows the blocks of the nodes right before its own in their layers
+    Vec<size_t> nBlocksBefore(nNodes, 0);
+    for (size_t n = 0; n < nNodes; ++n) {
+      if (ret.before[n] != none) {
+        ++nBlocksBefore[ret.root[n]];
+      }
+    }
+    for (size_t b = 0; b < nNodes; ++b) {
+      if (ret.root[b] == b && nBlocksBefore[b] == 0) {
+        ret.blockOrder.push_back(b);
+      }
+    }
+    for (size_t i = 0; i < ret.blockOrder.size(); ++i) {
+      size_t n = ret.blockOrder[i];
+      do {
+        if (ret.after[n] != none && --nBlocksBefore[ret.root[ret.after[n]]] == 0) {
+          ret.blockOrder.push_back(ret.root[ret.after[n]]);
+        }
+        n = ret.align[n];
+      } while (n != ret.blockOrder[i]);
+    }
+    [[maybe_unused]] size_t nBlocks = 0;
+    for (size_t n = 0; n < nNodes; ++n) {
+      nBlocks += ret.root[n] == n ? 1 : 0;
+    }
+    assert(ret.blockOrder.size() == nBlocks && "Blocks must not cross");
+    return ret;
+  }
+
+  /// Doubled distance between the centers of the nodes u and v, consecutive in the order,
+  /// 2 for the mandatory space between them
+  long separation(size_t u, size_t v) const {
+    return static_cast<long>(dimensions[u].col + dimensions[v].col + 2);
+  }
+
+  /// Packs the blocks towards the start of each layer and then pulls them towards the blocks
+  /// after them. Coordinates are doubled node centers, 2 * col + width - 1,
+  /// growing along the layer order.
+  Vec<long> compact(Alignment const& a) const {
+    size_t const nNodes = dimensions.size();
+    Vec<long> xs(nNodes, 0);
+    for (size_t b : a.blockOrder) {
+      size_t n = b;
+      do {
+        if (a.before[n] != none) {
+          xs[b] = std::max(xs[b], xs[a.root[a.before[n]]] + separation(a.before[n], n));
+        }
+        n = a.align[n];
+      } while (n != b);
+    }
+    for (auto b = a.blockOrder.rbegin(); b != a.blockOrder.rend(); ++b) {
+      long closest = std::numeric_limits<long>::max();
+      size_t n = *b;
+      do {
+        if (a.after[n] != none) {
+          closest = std::min(closest, xs[a.root[a.after[n]]] - separation(n, a.after[n]));
+        }
+        n = a.align[n];
+      } while (n != *b);
+      if (closest != std::numeric_limits<long>::max()) {
+        xs[*b] = std::max(xs[*b], closest);
+      }
+    }
+    Vec<long> ret(nNodes);
+    for (size_t n = 0; n < nNodes; ++n) {
+      ret[n] = xs[a.root[n]];
+    }
+    return ret;
+  }
+
+  /// Sets balanced to the average of the two middle centers of every node
+  /// among the four compacted alignments, as columns starting from 0
+  void balance(std::array<Alignment, 4> const& alignments) {
+    size_t const nNodes = dimensions.size();
+    std::array<Vec<long>, 4> candidates;
+    size_t narrowest = 0;
+    Vec<long> lo(candidates.size());
+    Vec<long> hi(candidates.size());
+    for (size_t variant = 0; variant < candidates.size(); ++variant) {
+      auto& xs = candidates[variant];
+      xs = compact(alignments[variant]);
+      lo[variant] = std::numeric_limits<long>::max();
+      hi[variant] = std::numeric_limits<long>::min();
+      for (size_t n = 0; n < nNodes; ++n) {
+        if (!alignments[variant].leftward) {
+          xs[n] = -xs[n];
+        }
+        long halfWidth = static_cast<long>(dimensions[n].col) - 1;
+        lo[variant] = std::min(lo[variant], xs[n] - halfWidth);
+        hi[variant] = std::max(hi[variant], xs[n] + halfWidth);
+      }
+      if (hi[variant] - lo[variant] < hi[narrowest] - lo[narrowest]) {
+        narrowest = variant;
+      }
+    }
+    // Align the left placements to the left border of the narrowest one,
+    // and the right placements to its right border
+    for (size_t variant = 0; variant < candidates.size(); ++variant) {
+      long shift = variant % 2 == 0 ? lo[narrowest] - lo[variant] : hi[narrowest] - hi[variant];
+      for (auto& x : candidates[variant]) {
+        x += shift;
+      }
+    }
+
+    balanced.resize(nNodes);
+    long minCol = std::numeric_limits<long>::max();
+    for (size_t n = 0; n < nNodes; ++n) {
+      std::array<long, 4> xs;
+      for (size_t variant = 0; variant < candidates.size(); ++variant) {
+        xs[variant] = candidates[variant][n];
+      }
+      std::sort(xs.begin(), xs.end());
+      long twiceCol = (xs[1] + xs[2]) / 2 - static_cast<long>(dimensions[n].col) + 1;
+      // Round down also for negative values
+      balanced[n] = twiceCol >= 0 ? twiceCol / 2 : -((1 - twiceCol) / 2);
+      minCol = std::min(minCol, balanced[n]);
+    }
+    balancedWidth = 0;
+    for (size_t n = 0; n < nNodes; ++n) {
+      balanced[n] -= minCol;
+      long end = balanced[n] + static_cast<long>(dimensions[n].col) + 1;
+      balancedWidth = std::max(balancedWidth, end);
+    }
+  }
+
+  Layering const& layers;
+  Vec<Position> const& dimensions;
+  /// The balanced column of every node, and the columns they span with a space after each node
+  Vec<long> balanced;
+  long balancedWidth = 0;
+};
+
+/// Sets the edges of the nodes and of their neighbors anew for the current coordinates,
+/// leaving conn.order as it is
+void reattachEdges(
+  Connectivity& conn,
+  GraphIndex const& index,
+  Vec<Position> const& coords,
+  Vec<size_t> const& nodes
+) {
+  Vec<size_t> stale(nodes.begin(), nodes.end());
+  for (size_t n : nodes) {
+    stale.insert(stale.end(), index.preds(n).begin(), index.preds(n).end());
+    stale.insert(stale.end(), index.succs(n).begin(), index.succs(n).end());
+  }
+  // Exit and entry parameters both set flags on either side of the node
+  for (size_t n : stale) {
+    conn.nodeValencies[n] = {};
+  }
+  for (size_t n : stale) {
+    setNodeExitParameters(conn, n, coords, index);
+  }
+  for (size_t n : stale) {
+    setNodeEntryParameters(conn, n, coords, index);
+  }
+}
+
+/// Whether adjustCoordsWithValencies would leave the columns of the layer as they are
+bool leavesRoomForSideEdges(
+  Vec<size_t> const& layer,
+  Vec<Position> const& coords,
+  Connectivity const& conn,
+  Vec<Position> const& dimensions
+) {
+  size_t lastCol = 0;
+  for (size_t n : layer) {
+    auto const& valency = conn.nodeValencies[n];
+    lastCol += hasLeftColumn(valency) ? 2 : 0;
+    if (coords[n].col < lastCol) {
+      return false;
+    }
+    lastCol = coords[n].col + 1 + dimensions[n].col + (hasRightColumn(valency) ? 2 : 0);
+  }
+  return true;
+}
+
+/// The lines the edges leaving the layer need, as stackLayers counts them
+size_t gapBelow(
+  Vec<size_t> const& layer,
+  Vec<Position> const& coords,
+  Connectivity const& conn,
+  Vec<size_t>& edges
+) {
+  edges.clear();
+  for (size_t n : layer) {
+    edges.insert(edges.end(), conn.succEdges[n].begin(), conn.succEdges[n].end());
+  }
+  std::sort(edges.begin(), edges.end(), [&coords, &conn](size_t a, size_t b) {
+    return compareEdges(coords, conn.edges[a], conn.edges[b]);
+  });
+  return minDistBetweenLayers(conn, edges, coords);
+}
+
+/// Doubled center of the median neighbor of the node n, or none if it has no neighbors
+std::optional<long> medianNeighborCenter(
+  GraphIndex const& index,
+  Vec<Position> const& coords,
+  size_t n,
+  Vec<long>& centers
+) {
+  auto const& dimensions = index.dimensions();
+  centers.clear();
+  for (auto const& neighbors : {index.preds(n), index.succs(n)}) {
+    for (size_t m : neighbors) {
+      centers.push_back(static_cast<long>(2 * coords[m].col + dimensions[m].col) - 1);
+    }
+  }
+  if (centers.empty()) {
+    return std::nullopt;
+  }
+  std::sort(centers.begin(), centers.end());
+  return (centers[(centers.size() - 1) / 2] + centers[centers.size() / 2]) / 2;
+}
+
+/// Moves the nodes of the settled layout in coords towards their MedianAlignedPlacement columns
+/// within the columns the layout already takes, a layer at a time, down and then up.
+/// The nodes of a layer that cannot move all together move one by one towards the median
+/// of their neighbors instead.
+/// A move stays only if the layers around it keep room for their side edges and their edges
+/// need no more lines, so the result is never wider or taller than the layout.
+/// conn follows the coordinates.
+void alignWithMedians(
+  GraphIndex const& index,
+  Layering const& layers,
+  Vec<Position>& coords,
+  Connectivity& conn
+) {
+  auto const& dimensions = index.dimensions();
+  MedianAlignedPlacement const placement(index, layers);
+  auto leftColumns = [&conn](size_t n) -> size_t {
+    return hasLeftColumn(conn.nodeValencies[n]) ? 2 : 0;
+  };
+  auto rightColumns = [&conn](size_t n) -> size_t {
+    return hasRightColumn(conn.nodeValencies[n]) ? 2 : 0;
+  };
+  // The canvas has one more column for the edges leaving or entering a node on the right
+  auto lastColumn = [&dimensions, &conn](size_t n, size_t col) {
+    return col + dimensions[n].col + (hasRightColumn(conn.nodeValencies[n]) ? 1 : 0);
+  };
+  size_t width = 0;
+  for (size_t n = 0; n < coords.size(); ++n) {
+    width = std::max(width, lastColumn(n, coords[n].col));
+  }
+  // Center the balanced alignment on the layout
+  long const shift = (static_cast<long>(width) + 1 - placement.width()) / 2;
+  auto toColumn = [](long target, size_t first, size_t last) {
+    return std::clamp(static_cast<size_t>(std::max(target, 0L)), first, std::max(first, last));
+  };
+
+  // Only the edges of the layer i and of the layers next to it move with it
+  auto roomAround = [&](size_t i) {
+    for (size_t j = i == 0 ? 0 : i - 1; j < std::min(layers.size(), i + 2); ++j) {
+      auto const& layer = layers[j];
+      if (
+        !leavesRoomForSideEdges(layer, coords, conn, dimensions)
+        || (!layer.empty() && width < lastColumn(layer.back(), coords[layer.back()].col))
+      ) {
+        return false;
+      }
     }
+    return true;
+  };
+  Vec<size_t> edges;
+  auto gapsAround = [&](size_t i) {
+    size_t ret = gapBelow(layers[i], coords, conn, edges);
+    return i == 0 ? ret : ret + gapBelow(layers[i - 1], coords, conn, edges);
+  };
+  Vec<size_t> previous;
+  Vec<size_t> moved;
+  // Moves the nodes to the columns and keeps them there if the layout gets no wider or taller
+  auto tryColumns = [&](size_t i, Vec<size_t> const& nodes, Vec<size_t> const& cols) {
+    size_t const gaps = gapsAround(i);
+    previous.clear();
+    for (size_t k = 0; k < nodes.size(); ++k) {
+      previous.push_back(coords[nodes[k]].col);
+      coords[nodes[k]].col = cols[k];
+    }
+    reattachEdges(conn, index, coords, nodes);
+    if (roomAround(i) && gapsAround(i) <= gaps) {
+      return true;
+    }
+    for (size_t k = 0; k < nodes.size(); ++k) {
+      coords[nodes[k]].col = previous[k];
+    }
+    reattachEdges(conn, index, coords, nodes);
+    return false;
+  };
+
+  Vec<size_t> cols;
+  Vec<long> centers;
+  auto alignLayer = [&](size_t i) {
+    auto const& layer = layers[i];
+    if (layer.empty() || !roomAround(i)) {
+      return;
+    }
+    // The last column every node can take with room for the nodes after it
+    cols.resize(layer.size());
+    cols.back() = width - lastColumn(layer.back(), 0);
+    for (size_t k = layer.size() - 1; 0 < k--;) {
+      size_t n = layer[k];
+      cols[k] = cols[k + 1] - leftColumns(layer[k + 1]) - rightColumns(n) - dimensions[n].col - 1;
+    }
+    size_t nextFree = 0;
+    for (size_t k = 0; k < layer.size(); ++k) {
+      size_t n = layer[k];
+      nextFree += leftColumns(n);
+      assert(nextFree <= cols[k] && "The layer already fits in the layout");
+      cols[k] = toColumn(placement.column(n) + shift, nextFree, cols[k]);
+      nextFree = cols[k] + dimensions[n].col + 1 + rightColumns(n);
+    }
+    auto atColumn = [&coords](size_t col, size_t n) {
+      return col == coords[n].col;
+    };
+    bool const aligned = std::equal(cols.begin(), cols.end(), layer.begin(), atColumn);
+    if (aligned || tryColumns(i, layer, cols)) {
+      return;
+    }
+    for (size_t k = 0; k < layer.size(); ++k) {
+      size_t n = layer[k];
+      auto center = medianNeighborCenter(index, coords, n, centers);
+      if (!center) {
+        continue;
+      }
+      size_t first = leftColumns(n);
+      if (k != 0) {
+        size_t before = layer[k - 1];
+        first += coords[before].col + dimensions[before].col + 1 + rightColumns(before);
+      }
+      size_t last = width - lastColumn(n, 0);
+      if (k + 1 != layer.size()) {
+        size_t after = layer[k + 1];
+        last = coords[after].col - leftColumns(after) - rightColumns(n) - dimensions[n].col - 1;
+      }
+      size_t col = toColumn((*center - static_cast<long>(dimensions[n].col) + 1) / 2, first, last);
+      if (col != coords[n].col) {
+        moved.assign(1, n);
+        cols.assign(1, col);
+        tryColumns(i, moved, cols);
+      }
+    }
+  };
+  for (size_t i = 0; i < layers.size(); ++i) {
+    alignLayer(i);
   }
-  for (size_t i = 0; i < conn.edges.size(); ++i) {
-    ret[nodeLayer[conn.edges[i].from]].push_back(i);
+  for (size_t i = layers.size(); 0 < i--;) {
+    alignLayer(i);
+  }
+  std::sort(conn.order.begin(), conn.order.end(), [&coords, &conn](size_t a, size_t b) {
+    return compareEdges(coords, conn.edges[a], conn.edges[b]);
+  });
+}
+
+Vec2<size_t> groupEdgesByLayer(Connectivity const& conn, Layering const& layers) {
+  Vec2<size_t> ret(layers.size());
+  // In the drawing order, as minDistBetweenLayers depends on the order of the edges
+  for (size_t e : conn.order) {
+    ret[layers.layerOf(conn.edges[e].from)].push_back(e);
   }
   return ret;
 }
 
+/// Leaves between every two layers as many lines as their edges need.
+/// Returns whether any line changed
+bool stackLayers(
+  Vec<Position>& coords,
+  Connectivity const& conn,
+  Layering const& layers,
+  Vec<size_t> const& layerHeight
+) {
+  bool moved = false;
+  auto interLayerEdges = groupEdgesByLayer(conn, layers);
+  assert(interLayerEdges.size() == layers.size());
+  size_t line = 0;
+  for (size_t i = 0; i < layers.size(); ++i) {
+    for (auto n : layers[i]) {
+      if (coords[n].line != line) {
+        moved = true;
+      }
+      coords[n].line = line;
+    }
+    line += layerHeight[i] + minDistBetweenLayers(conn, interLayerEdges[i], coords);
+  }
+  return moved;
+}
+
+/// Returns whether any node moved, and lists the nodes that changed columns in movedNodes
 bool adjustCoordsWithValencies(
   Vec<Position>& coords,
   Connectivity const& conn,
-  Vec2<size_t> const& layers,
+  Layering const& layers,
   Vec<Position> const& dimensions,
-  Vec<size_t> const& layerHeight
+  Vec<size_t> const& layerHeight,
+  Vec<size_t>& movedNodes
 ) {
+  movedNodes.clear();
   bool moved = false;
   for (auto const& layer : layers) {
     size_t lastCol = 0;
@@ -1373,6 +2562,7 @@ bool adjustCoordsWithValencies(
         lastCol = coords[node].col;
       } else if (coords[node].col < lastCol) {
         coords[node].col = lastCol;
+        movedNodes.push_back(node);
         moved = true;
       }
       lastCol += 1 + dimensions[node].col; // accomodate node width and mandatory space
@@ -1381,31 +2571,50 @@ bool adjustCoordsWithValencies(
       }
     }
   }
-  auto interLayerEdges = groupEdgesByLayer(conn, layers);
-  assert(interLayerEdges.size() == layers.size());
-  size_t line = 0;
-  for (size_t i = 0; i < layers.size(); ++i) {
-    for (auto n : layers[i]) {
-      if (coords[n].line != line) {
-        moved = true;
-      }
-      coords[n].line = line;
-    }
-    line += layerHeight[i] + minDistBetweenLayers(conn, interLayerEdges[i], coords);
+  return stackLayers(coords, conn, layers, layerHeight) || moved;
+}
+
+/// The text of every node, pointing into the DAG being rendered
+using NodeLabels = Vec<string_view>;
+
+NodeLabels labelsOf(DAG const& dag) {
+  NodeLabels ret;
+  ret.reserve(dag.nodes.size());
+  for (auto const& node : dag.nodes) {
+    ret.push_back(node.text);
   }
-  return moved;
+  return ret;
 }
 
-void placeNodes(DAG const& dag, Vec<Position> const& coordinates, Canvas& canvas) {
-  for (size_t n = 0; n < dag.nodes.size(); ++n) {
-    assert(!dag.nodes[n].text.empty());
-    canvas.newMark(coordinates[n], dag.nodes[n].text);
+NodeLabels labelsOf(CompactDAG const& dag) {
+  NodeLabels ret;
+  ret.reserve(dag.size());
+  for (CompactDAG::Id n = 0; n < dag.size(); ++n) {
+    ret.push_back(dag.text(n));
   }
+  return ret;
 }
 
-string rtrim(string s) {
-  s.erase(s.find_last_not_of(' ') + 1);
-  return s;
+void placeNodes(
+  NodeLabels const& labels,
+  GraphIndex const& index,
+  Vec<Position> const& coordinates,
+  Canvas& canvas
+) {
+  for (size_t n = 0; n < index.size(); ++n) {
+    switch (index.kind(n)) {
+    case NodeKind::Regular:
+      assert(!labels[n].empty());
+      canvas.newMark(coordinates[n], labels[n]);
+      break;
+    case NodeKind::Waypoint:
+      canvas.newMark(coordinates[n], waypointChar);
+      break;
+    case NodeKind::Cross:
+      canvas.newMark(coordinates[n], crossChar);
+      break;
+    }
+  }
 }
 
 template <typename T, typename C>
@@ -1421,50 +2630,117 @@ template <typename T, typename C>
   return true;
 }
 
-void placeEdges(
+RenderError unroutableEdge(Connectivity::Edge const& e) {
+  return {
+    RenderError::Code::Unroutable,
+    "No free path for the edge from node " + std::to_string(e.from) + " to node "
+      + std::to_string(e.to) + ".",
+    e.from
+  };
+}
+
+/// Draws the edges conn.order[first, last) in that order,
+/// carrying on past the ones it cannot route
+std::optional<RenderError> placeEdgeRange(
   Vec<Position> const& coordinates,
   Vec<Position> const& dimensions,
-  Vec<size_t> const& idToLayerMap,
+  Layering const& layers,
   Vec<size_t> const& layerHeights,
-  Vec<Connectivity::Edge> const& edges,
+  Connectivity const& conn,
+  size_t first,
+  size_t last,
   Canvas& canvas
 ) {
-  assert(isSorted(edges, [&coordinates](auto const& e1, auto const& e2) {
-    return compareEdges(coordinates, e1, e2);
-  }));
-  for (auto const& e : edges) {
+  std::optional<RenderError> firstErr;
+  auto report = [&firstErr](Connectivity::Edge const& e) {
+    if (!firstErr) {
+      firstErr = unroutableEdge(e);
+    }
+  };
+  for (size_t i = first; i < last; ++i) {
+    auto const& e = conn.edges[conn.order[i]];
     auto fromPos = coordinates[e.from];
     fromPos.col += e.exitOffset;
     fromPos.line += dimensions[e.from].line - 1;
     auto toPos = coordinates[e.to];
     toPos.col += e.entryOffset;
-    auto layerHight = layerHeights[idToLayerMap[e.from]];
+    auto layerHight = layerHeights[layers.layerOf(e.from)];
     assert(dimensions[e.from].line + 1 != layerHight);
     if (dimensions[e.from].line + 1 < layerHight) {
       Position gatePos = fromPos;
       gatePos.line = coordinates[e.from].line + layerHight;
       gatePos.col += directionShift(e.exitAngle);
-      bool success = drawEdge(fromPos, e.exitAngle, gatePos, Direction::Straight, canvas);
-      assert(success);
+      if (!drawEdge(fromPos, e.exitAngle, gatePos, Direction::Straight, canvas)) {
+        report(e);
+        continue;
+      }
       fromPos.line = gatePos.line - 1;
     }
-    [[maybe_unused]] bool success = drawEdge(fromPos, e.exitAngle, toPos, e.entryAngle, canvas);
-    assert(sketchMode || success);
+    if (!drawEdge(fromPos, e.exitAngle, toPos, e.entryAngle, canvas)) {
+      report(e);
+    }
   }
+  return firstErr;
 }
 
-struct EdgeStep {
-  Position initialPos;
-  Position markedPos;
-  Direction initialDir;
-  std::optional<Direction> nextDir;
-};
+/// Below that, starting threads costs more than drawing the edges
+constexpr size_t minEdgesToDrawInParallel = 128;
 
-std::pair<Direction, Direction> chooseNextDirection(
-  Position const& cur,
-  Direction curDir,
-  Position const& to,
-  Direction finishDir
+/// Draws the edges in the order of conn.order and reports the first one it could not route.
+/// The edges leaving a layer only touch the lines between that layer and the next one,
+/// so the bands of different layers are drawn on up to maxThreads threads without locking,
+/// producing the same canvas as drawing them one by one.
+std::optional<RenderError> placeEdges(
+  Vec<Position> const& coordinates,
+  Vec<Position> const& dimensions,
+  Layering const& layers,
+  Vec<size_t> const& layerHeights,
+  Connectivity const& conn,
+  size_t maxThreads,
+  Canvas& canvas
+) {
+  assert(isSorted(conn.order, [&coordinates, &conn](size_t e1, size_t e2) {
+    return compareEdges(coordinates, conn.edges[e1], conn.edges[e2]);
+  }));
+  auto const& order = conn.order;
+  // The order starts with the line of the source node, so every band is contiguous
+  Vec<size_t> bandStarts;
+  for (size_t i = 0; i < order.size(); ++i) {
+    size_t layer = layers.layerOf(conn.edges[order[i]].from);
+    if (i == 0 || layer != layers.layerOf(conn.edges[order[i - 1]].from)) {
+      bandStarts.push_back(i);
+    }
+  }
+  size_t const nBands = bandStarts.size();
+  bandStarts.push_back(order.size());
+  size_t nThreads = order.size() < minEdgesToDrawInParallel ? 1 : std::min(maxThreads, nBands);
+  if (nThreads <= 1) {
+    return placeEdgeRange(coordinates, dimensions, layers, layerHeights, conn, 0, order.size(), canvas);
+  }
+
+  Vec<std::optional<RenderError>> bandErrs(nBands);
+  std::atomic<size_t> nextBand{0};
+  auto drawBands = [&]() {
+    for (size_t band = nextBand++; band < nBands; band = nextBand++) {
+      bandErrs[band] = placeEdgeRange(
+        coordinates, dimensions, layers, layerHeights, conn, bandStarts[band], bandStarts[band + 1], canvas
+      );
+    }
+  };
+  runOnThreads(nThreads, drawBands);
+  for (auto& err : bandErrs) {
+    if (err) {
+      return err;
+    }
+  }
+  return std::nullopt;
+}
+
+std::pair<Direction, Direction> chooseNextDirection(
+  Position const& cur,
+  Direction curDir,
+  Position const& to,
+  Direction finishDir
 ) {
   auto targetCol = to.col - directionShift(finishDir);
   if (cur.col == targetCol) {
@@ -1495,76 +2771,94 @@ Position nextPosInDir(Position curPos, Direction curDir, Direction nextDir) {
   return curPos;
 }
 
-void eraseAndBacktrackToLastChoice(Vec<EdgeStep>& drawnPath, Canvas& canvas) {
-  while (!drawnPath.empty() && !drawnPath.back().nextDir.has_value()) {
-    canvas.clearPos(drawnPath.back().markedPos);
-    drawnPath.pop_back();
-  }
-  if (!drawnPath.empty()) {
-    canvas.clearPos(drawnPath.back().markedPos);
-  }
-}
+struct RouteStep {
+  Position pos;
+  Direction dir;
+};
 
-bool tryDrawLine(
+/// Finds the path of an edge that already made its first step to `first` in direction `firstDir`
+/// and must end on the line above `to` entering it in direction `entryDir`.
+/// On every line the edge may take the preferred or the alternative direction
+/// suggested by chooseNextDirection, in that order, through empty cells only.
+/// This is a depth-first search over the (line, column, direction) states of the gap
+/// that remembers dead-end states, so every state is expanded at most once:
+/// it returns the first path in the preference order, or nullopt if none exists.
+/// The returned path covers the lines from `first` to the line two above `to`.
+std::optional<Vec<RouteStep>> routeEdge(
+  Position const& first,
+  Direction firstDir,
   Position const& to,
-  Direction const entryDir,
-  Canvas& canvas,
-  Vec<EdgeStep>& drawnPath
+  Direction entryDir,
+  Canvas const& canvas
 ) {
-  if (drawnPath.empty()) {
-    return false;
-  }
-  EdgeStep& lastStep = drawnPath.back();
-  Direction curDir = *lastStep.nextDir;
-  lastStep.initialPos = nextPosInDir(lastStep.initialPos, lastStep.initialDir, curDir);
-  canvas.newMark(lastStep.initialPos, edgeChar(curDir));
-  lastStep.markedPos = lastStep.initialPos;
-  lastStep.nextDir = std::nullopt;
-
-  Position cur = lastStep.initialPos;
-  while (cur.line + 2 < to.line) {
-    EdgeStep step;
-    auto [nextDir, alternativeNextDir] = chooseNextDirection(cur, curDir, to, entryDir);
-    step.initialPos = cur;
-    step.initialDir = curDir;
-    step.nextDir = std::nullopt;
-    auto nextPos = nextPosInDir(cur, curDir, nextDir);
-    auto altPos = nextPosInDir(cur, curDir, alternativeNextDir);
-    if (canvas.inBounds(nextPos) && canvas.isEmpty(nextPos)) {
-      cur = nextPos;
-      curDir = nextDir;
-      if (canvas.inBounds(altPos) && canvas.isEmpty(altPos)) {
-        step.nextDir = alternativeNextDir;
-      }
-    } else if (canvas.inBounds(altPos) && canvas.isEmpty(altPos)) {
-      // Pivot immediately
-      cur = altPos;
-      curDir = alternativeNextDir;
+  assert(first.line + 2 <= to.line);
+  size_t const lastLine = to.line - 2;
+  // Every step shifts the column by at most one, which bounds the reachable columns
+  size_t const reach = lastLine - first.line;
+  size_t const nCols = 2 * reach + 1;
+  Vec<bool> dead((reach + 1) * nCols * 3, false);
+  auto stateIndex = [&](Position const& pos, Direction dir) {
+    size_t col = pos.col + reach - first.col;
+    assert(col < nCols);
+    return ((pos.line - first.line) * nCols + col) * 3 + toInt(dir) - 1;
+  };
+
+  Vec<RouteStep> path{{first, firstDir}};
+  // The number of direction options already tried for each step of the path
+  Vec<size_t> triedOptions{0};
+  while (!path.empty()) {
+    auto const [cur, curDir] = path.back();
+    bool advanced = false;
+    if (cur.line == lastLine) {
+      if (cur.col - columnShift[toInt(curDir)][toInt(entryDir)] == to.col - directionShift(entryDir)) {
+        return path;
+      }
     } else {
-      return false;
+      auto [nextDir, alternativeNextDir] = chooseNextDirection(cur, curDir, to, entryDir);
+      while (triedOptions.back() < 2 && !advanced) {
+        Direction dir = triedOptions.back() == 0 ? nextDir : alternativeNextDir;
+        ++triedOptions.back();
+        auto nextPos = nextPosInDir(cur, curDir, dir);
+        if (canvas.inBounds(nextPos) && canvas.isEmpty(nextPos) && !dead[stateIndex(nextPos, dir)]) {
+          path.push_back({nextPos, dir});
+          triedOptions.push_back(0);
+          advanced = true;
+        }
+      }
+    }
+    if (!advanced) {
+      dead[stateIndex(cur, curDir)] = true;
+      path.pop_back();
+      triedOptions.pop_back();
     }
-    step.markedPos = cur;
-    canvas.newMark(cur, edgeChar(curDir));
-    drawnPath.push_back(step);
   }
-  assert(cur.line + 2 == to.line);
-  return cur.col - columnShift[toInt(curDir)][toInt(entryDir)] == to.col - directionShift(entryDir);
+  return std::nullopt;
+}
+
+/// The waypoint and crossing nodes are not known to the user,
+/// so attribute an error on one of them to the node its edge comes from
+size_t originalSource(GraphIndex const& index, size_t nOriginalNodes, size_t nodeId) {
+  while (nOriginalNodes <= nodeId) {
+    assert(!index.preds(nodeId).empty());
+    nodeId = index.preds(nodeId)[0];
+  }
+  return nodeId;
 }
 
-std::optional<RenderError> checkDAGCompat(DAG const& dag) {
-  for (size_t n = 0; n < dag.nodes.size(); ++n) {
-    if (dag.nodes[n].text.empty()) {
+std::optional<RenderError> checkDAGCompat(NodeLabels const& labels) {
+  for (size_t n = 0; n < labels.size(); ++n) {
+    if (labels[n].empty()) {
       return {{RenderError::Code::Unsupported, "empty nodes are not supported.", n}};
     }
   }
   return {};
 }
 
-Position singleNodeDimensions(DAG::Node const& n) {
-  assert(!n.text.empty());
+Position labelDimensions(string_view text) {
+  assert(!text.empty());
   Position ret{1, 0};
   size_t lineLen = 0;
-  for (char c : n.text) {
+  for (char c : text) {
     if (c == '\n') {
       ret.col = std::max(ret.col, lineLen);
       ++ret.line;
@@ -1577,31 +2871,19 @@ Position singleNodeDimensions(DAG::Node const& n) {
   return ret;
 }
 
-Vec<Position> nodeDimensions(DAG const& dag) {
-  Vec<Position> ret;
-  ret.reserve(dag.nodes.size());
-  std::transform(dag.nodes.begin(), dag.nodes.end(), std::back_inserter(ret), singleNodeDimensions);
-  return ret;
-}
-
-std::optional<RenderError> checkIfEdgesFitOnNodes(DAG const& dag) {
-  size_t const N = dag.nodes.size();
-  Vec<size_t> incomingEdgesPerNode(N, 0);
-  auto const dimensions = nodeDimensions(dag);
+std::optional<RenderError> checkIfEdgesFitOnNodes(GraphIndex const& index) {
+  size_t const N = index.size();
+  auto const& dimensions = index.dimensions();
 
   for (size_t i = 0; i < N; ++i) {
-    auto const& n = dag.nodes[i];
-    if (2 + dimensions[i].col < n.succs.size()) {
+    if (2 + dimensions[i].col < index.succs(i).size()) {
       return {
         {RenderError::Code::Overcrowded, "Too many outgoing edges from a node, they don't fit.", i}
       };
     }
-    for (auto const& s : n.succs) {
-      ++incomingEdgesPerNode[s];
-    }
   }
   for (size_t i = 0; i < N; ++i) {
-    if (2 + dimensions[i].col < incomingEdgesPerNode[i]) {
+    if (2 + dimensions[i].col < index.preds(i).size()) {
       return {
         {RenderError::Code::Overcrowded, "Too many incoming edges to a node, they don't fit.", i}
       };
@@ -1610,62 +2892,315 @@ std::optional<RenderError> checkIfEdgesFitOnNodes(DAG const& dag) {
   return {};
 }
 
-size_t findTargetPosTimes6(Vec<size_t> linkedNodes, std::vector<size_t> layer) {
+template <typename Ids>
+size_t findTargetPosTimes6(Ids const& linkedNodes, Layering const& layers) {
   size_t const count = linkedNodes.size();
   assert(0 < count && "Leaf or root node on a non-first layer");
   size_t sum = 0;
   for (auto pred : linkedNodes) {
-    sum += findIndex(layer, pred);
+    sum += layers.posOf(pred);
   }
   return sum * 6 / count;
 }
 
-template <typename Callable>
+/// Same as findTargetPosTimes6, with the median instead of the mean:
+/// the lower and upper medians averaged for an even count.
+/// positions is just a reused buffer.
+template <typename Ids>
+size_t findMedianPosTimes6(Ids const& linkedNodes, Layering const& layers, Vec<size_t>& positions) {
+  assert(!linkedNodes.empty() && "Leaf or root node on a non-first layer");
+  positions.clear();
+  for (size_t n : linkedNodes) {
+    positions.push_back(layers.posOf(n));
+  }
+  auto upperMedian = positions.begin() + positions.size() / 2;
+  std::nth_element(positions.begin(), upperMedian, positions.end());
+  if (positions.size() % 2 == 1) {
+    return *upperMedian * 6;
+  }
+  return (*std::max_element(positions.begin(), upperMedian) + *upperMedian) * 3;
+}
+
+/// 6 times the position the heuristic aims at for a node with the given neighbors
+class TargetPositions {
+public:
+  TargetPositions(Layering const& layers, RenderOptions::CrossingHeuristic heuristic)
+    : layers(layers), heuristic(heuristic) {}
+
+  template <typename Ids>
+  size_t times6(Ids const& linkedNodes) {
+    switch (heuristic) {
+      case RenderOptions::CrossingHeuristic::Barycenter:
+        break;
+      case RenderOptions::CrossingHeuristic::Median:
+        return findMedianPosTimes6(linkedNodes, layers, positions);
+    }
+    return findTargetPosTimes6(linkedNodes, layers);
+  }
+
+private:
+  Layering const& layers;
+  RenderOptions::CrossingHeuristic heuristic;
+  Vec<size_t> positions;
+};
+
+/// Number of crossings between the edges of two nodes of the same layer
+/// when the node with `leftPositions` is placed to the left of the one with `rightPositions`.
+/// Both lists hold the sorted positions of the nodes' neighbors in the fixed adjacent layer.
+size_t pairCrossings(Vec<size_t> const& leftPositions, Vec<size_t> const& rightPositions) {
+  size_t ret = 0;
+  size_t nRightBefore = 0;
+  for (size_t pos : leftPositions) {
+    while (nRightBefore < rightPositions.size() && rightPositions[nRightBefore] < pos) {
+      ++nRightBefore;
+    }
+    ret += nRightBefore;
+  }
+  return ret;
+}
+
+/// Pairwise crossing contributions c(u, v) among a run of nodes in a layer:
+/// the crossings between edges of u and v when u is to the left of v.
+/// Each one is merged from the sorted neighbor positions in O(deg u + deg v) when first asked for
+/// and then read in O(1). Only the pairs asked for are kept, not all the pairs of the run.
+class PairCrossings {
+public:
+  explicit PairCrossings(Vec2<size_t> neighborPositions)
+    : neighborPositions(std::move(neighborPositions)) {}
+
+  size_t operator()(size_t left, size_t right) {
+    auto [it, inserted] = memo.try_emplace(left * neighborPositions.size() + right, 0);
+    if (inserted) {
+      it->second = pairCrossings(neighborPositions[left], neighborPositions[right]);
+    }
+    return it->second;
+  }
+
+private:
+  Vec2<size_t> neighborPositions;
+  std::unordered_map<
+    size_t,
+    size_t,
+    std::hash<size_t>,
+    std::equal_to<size_t>,
+    ScratchAllocator<std::pair<size_t const, size_t>>>
+    memo;
+};
+
+/// A pass of adjacent exchanges compares fewer pairs than the run has nodes,
+/// so bounding the passes keeps the merges and the memo linear in the run.
+/// On the benchmark graphs every run settles within three passes.
+constexpr size_t maxExchangePasses = 4;
+
+/// Runs adjacent exchanges among the nodes at [runBegin, runEnd) of the layer
+/// until no swap reduces the crossings with the fixed adjacent layer, or for maxExchangePasses
+template <typename NeighborsOf>
+void exchangeNeighborsToConvergence(
+  Layering& layers,
+  size_t layerI,
+  size_t runBegin,
+  size_t runEnd,
+  NeighborsOf const& neighborsOf
+) {
+  auto const& curLayer = layers[layerI];
+  Vec2<size_t> neighborPositions;
+  neighborPositions.reserve(runEnd - runBegin);
+  for (size_t pos = runBegin; pos < runEnd; ++pos) {
+    auto& positions = neighborPositions.emplace_back();
+    for (size_t neighbor : neighborsOf(curLayer[pos])) {
+      positions.push_back(layers.posOf(neighbor));
+    }
+    std::sort(positions.begin(), positions.end());
+  }
+  PairCrossings crossings(std::move(neighborPositions));
+  // order[i] is the index in crossings of the node now at runBegin + i
+  Vec<size_t> order(runEnd - runBegin);
+  std::iota(order.begin(), order.end(), 0);
+  bool swapped = true;
+  for (size_t pass = 0; swapped && pass < maxExchangePasses; ++pass) {
+    swapped = false;
+    for (size_t i = 1; i < order.size(); ++i) {
+      if (crossings(order[i], order[i - 1]) < crossings(order[i - 1], order[i])) {
+        std::swap(order[i - 1], order[i]);
+        layers.swapNeighbors(layerI, runBegin + i);
+        swapped = true;
+      }
+    }
+  }
+}
+
+/// The layer must be sorted by targetPos.
+/// The nodes that compete for the same position are swapped
+/// whenever it reduces the nCrossings with the fixed adjacent layer.
+template <typename NeighborsOf>
 void swapEquipotentialNeighbors(
   Vec<size_t> const& targetPos,
-  Vec<size_t>& curLayer,
-  Callable const& penalty
+  Layering& layers,
+  size_t layerI,
+  size_t nCrossings,
+  NeighborsOf const& neighborsOf
 ) {
-  size_t nCrossings = penalty(curLayer);
-  if (0 < nCrossings) {
-    for (size_t nodePos = 1; nodePos < curLayer.size(); ++nodePos) {
-      if (targetPos[curLayer[nodePos - 1]] == targetPos[curLayer[nodePos]]) {
-        // If the two nodes compete for the same position, try to swapt them
-        std::swap(curLayer[nodePos - 1], curLayer[nodePos]);
-        size_t newNCrossings = penalty(curLayer);
-        if (newNCrossings < nCrossings) {
-          nCrossings = newNCrossings;
-        } else {
-          // Not useful, put the nodes back
-          std::swap(curLayer[nodePos - 1], curLayer[nodePos]);
+  if (nCrossings == 0) {
+    return;
+  }
+  auto const& curLayer = layers[layerI];
+  size_t runBegin = 0;
+  while (runBegin < curLayer.size()) {
+    size_t runEnd = runBegin + 1;
+    while (runEnd < curLayer.size() && targetPos[curLayer[runEnd]] == targetPos[curLayer[runBegin]]) {
+      ++runEnd;
+    }
+    if (1 < runEnd - runBegin) {
+      exchangeNeighborsToConvergence(layers, layerI, runBegin, runEnd, neighborsOf);
+    }
+    runBegin = runEnd;
+  }
+}
+
+/// Positions of the nodes of a standalone layer, looked up by binary search on node id
+class LayerPositions {
+public:
+  explicit LayerPositions(Vec<size_t> const& layer) {
+    idToPos.reserve(layer.size());
+    for (size_t pos = 0; pos < layer.size(); ++pos) {
+      idToPos.emplace_back(layer[pos], pos);
+    }
+    std::sort(idToPos.begin(), idToPos.end());
+  }
+
+  std::optional<size_t> find(size_t nodeId) const {
+    auto iter = std::lower_bound(idToPos.begin(), idToPos.end(), std::make_pair(nodeId, size_t{0}));
+    if (iter == idToPos.end() || iter->first != nodeId) {
+      return std::nullopt;
+    }
+    return iter->second;
+  }
+
+private:
+  Vec<std::pair<size_t, size_t>> idToPos;
+};
+
+/// Minimum over an array with point updates, supporting the search
+/// for the left-most element at or after a given index that is below a threshold
+class MinSegmentTree {
+public:
+  static constexpr size_t infinity = std::numeric_limits<size_t>::max();
+
+  explicit MinSegmentTree(Vec<size_t> const& values) {
+    while (nLeaves < values.size()) {
+      nLeaves *= 2;
+    }
+    tree.assign(2 * nLeaves, infinity);
+    std::copy(values.begin(), values.end(), tree.begin() + nLeaves);
+    for (size_t i = nLeaves - 1; 0 < i; --i) {
+      tree[i] = std::min(tree[2 * i], tree[2 * i + 1]);
+    }
+  }
+
+  void set(size_t index, size_t value) {
+    index += nLeaves;
+    tree[index] = value;
+    for (index /= 2; 0 < index; index /= 2) {
+      tree[index] = std::min(tree[2 * index], tree[2 * index + 1]);
+    }
+  }
+
+  std::optional<size_t> findFirstBelow(size_t from, size_t threshold) const {
+    return findFirstBelow(1, 0, nLeaves, from, threshold);
+  }
+
+private:
+  std::optional<size_t> findFirstBelow(
+    size_t node,
+    size_t nodeBegin,
+    size_t nodeEnd,
+    size_t from,
+    size_t threshold
+  ) const {
+    if (nodeEnd <= from || threshold <= tree[node]) {
+      return std::nullopt;
+    }
+    if (nodeEnd - nodeBegin == 1) {
+      return nodeBegin;
+    }
+    size_t mid = (nodeBegin + nodeEnd) / 2;
+    if (auto found = findFirstBelow(2 * node, nodeBegin, mid, from, threshold)) {
+      return found;
+    }
+    return findFirstBelow(2 * node + 1, mid, nodeEnd, from, threshold);
+  }
+
+  size_t nLeaves = 1;
+  // 1-based implicit binary tree, leaves start at nLeaves
+  Vec<size_t> tree;
+};
+
+/// Bilayer cross counting with an accumulator tree (Barth, Juenger, Mutzel):
+/// visit the edges sorted by their upper and then lower end, and for each edge
+/// count the already visited edges whose lower end lies strictly to the right.
+template <typename PosLookup>
+size_t countBilayerCrossings(
+  GraphIndex const& index,
+  Vec<size_t> const& lAbove,
+  size_t lowerWidth,
+  PosLookup const& posBelow
+) {
+  size_t firstLeaf = 1;
+  while (firstLeaf < lowerWidth) {
+    firstLeaf *= 2;
+  }
+  Vec<size_t> tree(2 * firstLeaf - 1, 0);
+  --firstLeaf;
+  Vec<size_t> succPositions;
+  size_t ret = 0;
+  for (size_t n : lAbove) {
+    succPositions.clear();
+    for (size_t succ : index.succs(n)) {
+      succPositions.push_back(posBelow(succ));
+    }
+    std::sort(succPositions.begin(), succPositions.end());
+    for (size_t pos : succPositions) {
+      size_t slot = pos + firstLeaf;
+      ++tree[slot];
+      while (0 < slot) {
+        if (slot % 2 == 1) {
+          // Left child: everything in the right sibling ends further right
+          ret += tree[slot + 1];
         }
+        slot = (slot - 1) / 2;
+        ++tree[slot];
       }
     }
   }
+  return ret;
 }
 
-size_t countAllCrossings(Vec2<size_t> const& layers, DAG const& dag) {
+size_t countAllCrossings(Layering const& layers, GraphIndex const& index) {
   size_t ret = 0;
   size_t const nLayers = layers.size();
   for (size_t layerI = 1; layerI < nLayers; ++layerI) {
-    auto const& prevLayer = layers[layerI - 1];
-    auto& curLayer = layers[layerI];
-    ret += countCrossings(dag, prevLayer, curLayer);
+    ret += countCrossings(index, layers, layerI - 1);
   }
   return ret;
 }
 
-Vec2<size_t>
-findForcedLeftNodesBecauseOfCrossings(DAG const& dag, Vec2<size_t> const& preds) {
-  size_t const N = dag.nodes.size();
+Vec2<size_t> findForcedLeftNodesBecauseOfCrossings(
+  GraphIndex const& index,
+  Layering const& layers
+) {
+  size_t const N = index.size();
   Vec2<size_t> leftNodes(N);
   for (size_t nodeId = 0; nodeId < N; ++nodeId) {
-    if (dag.nodes[nodeId].text == "X") {
+    if (index.kind(nodeId) == NodeKind::Cross) {
       // Triple-crossings can be supported if needed
-      assert(preds[nodeId].size() == 2);
-      assert(dag.nodes[nodeId].succs.size() == 2);
-      leftNodes[preds[nodeId][1]].push_back(preds[nodeId][0]);
-      leftNodes[dag.nodes[nodeId].succs[1]].push_back(dag.nodes[nodeId].succs[0]);
+      auto preds = index.preds(nodeId);
+      assert(preds.size() == 2);
+      assert(index.succs(nodeId).size() == 2);
+      auto [predLeft, predRight] = std::minmax(preds[0], preds[1], [&layers](size_t a, size_t b) {
+        return layers.posOf(a) < layers.posOf(b);
+      });
+      leftNodes[predRight].push_back(predLeft);
+      leftNodes[index.succs(nodeId)[1]].push_back(index.succs(nodeId)[0]);
     }
   }
   return leftNodes;
@@ -1684,88 +3219,219 @@ void keepOrderOf(Vec<size_t> const& layer, Vec<size_t>& targetPos6, Vec2<size_t>
 }
 
 void minimizeCrossingsForward(
-  Vec2<size_t>& layers,
-  DAG const& dag,
-  Vec2<size_t> const& preds,
-  Vec2<size_t> const& leftNodes
+  Layering& layers,
+  GraphIndex const& index,
+  Vec2<size_t> const& leftNodes,
+  RenderOptions::CrossingHeuristic heuristic
 ) {
   size_t const nLayers = layers.size();
-  Vec<size_t> targetPos6(dag.nodes.size());
+  Vec<size_t> targetPos6(index.size());
+  TargetPositions target(layers, heuristic);
   LOG(leftNodes <<"\n");
   for (size_t layerI = 1; layerI < nLayers; ++layerI) {
-    auto const& prevLayer = layers[layerI - 1];
-    auto& curLayer = layers[layerI];
-    for (size_t nId : curLayer) {
-      assert(0 < preds[nId].size() && "Root node can only be on the 0-th layer.");
-      targetPos6[nId] = findTargetPosTimes6(preds[nId], prevLayer);
+    for (size_t nId : layers[layerI]) {
+      if (index.preds(nId).empty()) {
+        // A root below the 0-th layer (width-bounded layering), look at your successors
+        assert(layerI + 1 < nLayers && "A root on the last layer is a component of its own");
+        // Scale like the predecessor-less nodes of the backward sweep
+        targetPos6[nId] = target.times6(index.succs(nId))
+                        * layers[layerI - 1].size() / layers[layerI + 1].size();
+      } else {
+        targetPos6[nId] = target.times6(index.preds(nId));
+      }
     }
-    keepOrderOf(curLayer, targetPos6, leftNodes);
-    auto layerCopy = curLayer;
+    keepOrderOf(layers[layerI], targetPos6, leftNodes);
+    auto layerCopy = layers[layerI];
     size_t totCrossings =
-      countCrossings(dag, prevLayer, curLayer)
-      + (layerI + 1 < nLayers ? countCrossings(dag, curLayer, layers[layerI + 1]) : 0);
-    std::stable_sort(curLayer.begin(), curLayer.end(), [&targetPos6](size_t n1id, size_t n2id) {
+      countCrossings(index, layers, layerI - 1)
+      + (layerI + 1 < nLayers ? countCrossings(index, layers, layerI) : 0);
+    layers.stableSortLayer(layerI, [&targetPos6](size_t n1id, size_t n2id) {
       return targetPos6[n1id] < targetPos6[n2id];
     });
-    swapEquipotentialNeighbors(targetPos6, curLayer, [&dag, &prevLayer](auto const& curLayer) {
-      return countCrossings(dag, prevLayer, curLayer);
+    size_t const predCrossings = countCrossings(index, layers, layerI - 1);
+    swapEquipotentialNeighbors(targetPos6, layers, layerI, predCrossings, [&index](size_t nId) {
+      return index.preds(nId);
     });
     size_t newCrossings =
-      countCrossings(dag, prevLayer, curLayer)
-      + (layerI + 1 < nLayers ? countCrossings(dag, curLayer, layers[layerI + 1]) : 0);
+      countCrossings(index, layers, layerI - 1)
+      + (layerI + 1 < nLayers ? countCrossings(index, layers, layerI) : 0);
     if (totCrossings < newCrossings) {
-      curLayer = layerCopy;
+      layers.reorderLayer(layerI, std::move(layerCopy));
     }
   }
 }
 
 void minimizeCrossingsBackward(
-  Vec2<size_t>& layers,
-  DAG const& dag,
-  Vec2<size_t> const& preds,
-  Vec2<size_t> const& leftNodes
+  Layering& layers,
+  GraphIndex const& index,
+  Vec2<size_t> const& leftNodes,
+  RenderOptions::CrossingHeuristic heuristic
 ) {
   size_t const nLayers = layers.size();
-  Vec<size_t> targetPos6(dag.nodes.size());
+  Vec<size_t> targetPos6(index.size());
+  TargetPositions target(layers, heuristic);
 
   for (size_t i = 1; i < nLayers; ++i) {
-    auto& curLayer = layers[nLayers - i - 1];
-    auto const& nextLayer = layers[nLayers - i];
+    size_t const layerI = nLayers - i - 1;
+    auto const& curLayer = layers[layerI];
+    auto const& nextLayer = layers[layerI + 1];
     for (size_t position = 0; position < curLayer.size(); ++position) {
       size_t nId = curLayer[position];
-      auto const& succs = dag.nodes[nId].succs;
+      auto succs = index.succs(nId);
       if (succs.empty()) {
         if (i + 1 < nLayers) {
           // No successors, look at your predecessors
-          assert(!preds[nId].empty());
-          auto& prevLayer = layers[nLayers - i - 2];
+          assert(!index.preds(nId).empty());
+          auto const& prevLayer = layers[layerI - 1];
           // Scale the nextLayer width to be comparable
           // with positions of other nodes that are defined by nextLayers
-          targetPos6[nId] = findTargetPosTimes6(preds[nId], prevLayer) * nextLayer.size() / prevLayer.size();
+          targetPos6[nId] =
+            target.times6(index.preds(nId)) * nextLayer.size() / prevLayer.size();
         } else {
           // Complete orphan, stay where you are
           targetPos6[nId] = position * 6;
         }
       } else {
-        targetPos6[nId] = findTargetPosTimes6(succs, nextLayer);
+        targetPos6[nId] = target.times6(succs);
       }
     }
     keepOrderOf(curLayer, targetPos6, leftNodes);
     auto layerCopy = curLayer;
     size_t totCrossings =
-      countCrossings(dag, curLayer, nextLayer)
-      + (i + 1 < nLayers ? countCrossings(dag, layers[nLayers - i - 2], curLayer) : 0);
-    std::stable_sort(curLayer.begin(), curLayer.end(), [&targetPos6](size_t n1id, size_t n2id) {
+      countCrossings(index, layers, layerI)
+      + (i + 1 < nLayers ? countCrossings(index, layers, layerI - 1) : 0);
+    layers.stableSortLayer(layerI, [&targetPos6](size_t n1id, size_t n2id) {
       return targetPos6[n1id] < targetPos6[n2id];
     });
-    swapEquipotentialNeighbors(targetPos6, curLayer, [&dag, &nextLayer](auto const& curLayer) {
-      return countCrossings(dag, curLayer, nextLayer);
+    size_t const succCrossings = countCrossings(index, layers, layerI);
+    swapEquipotentialNeighbors(targetPos6, layers, layerI, succCrossings, [&index](size_t nId) {
+      return index.succs(nId);
     });
     size_t newCrossings =
-      countCrossings(dag, curLayer, nextLayer)
-      + (i + 1 < nLayers ? countCrossings(dag, layers[nLayers - i - 2], curLayer) : 0);
+      countCrossings(index, layers, layerI)
+      + (i + 1 < nLayers ? countCrossings(index, layers, layerI - 1) : 0);
     if (totCrossings < newCrossings) {
-      curLayer = layerCopy;
+      layers.reorderLayer(layerI, std::move(layerCopy));
+    }
+  }
+}
+
+/// Moves the nodes of the layer one by one, each to the spot among the others with
+/// the fewest crossings to both adjacent layers (sifting, Matuszewski, Schönfeld, Molitor).
+/// Every slot costs a merge of the neighbor positions of two nodes, so sifting node v
+/// takes O(edges of the layer + width * deg v); nothing is memoized, every pair comes up
+/// once per sifted node. A node stays right of its leftNodes and left of its rightNodes.
+/// Returns whether any node moved.
+bool siftLayer(
+  Layering& layers,
+  GraphIndex const& index,
+  size_t layerI,
+  Vec2<size_t> const& leftNodes,
+  Vec2<size_t> const& rightNodes
+) {
+  size_t const width = layers[layerI].size();
+  if (width < 2) {
+    return false;
+  }
+  size_t const nCrossings =
+    (0 < layerI ? countCrossings(index, layers, layerI - 1) : 0)
+    + (layerI + 1 < layers.size() ? countCrossings(index, layers, layerI) : 0);
+  if (nCrossings == 0) {
+    return false;
+  }
+  // The nodes in their order before sifting, also their indices in the neighbor positions
+  Vec<size_t> const nodes = layers[layerI];
+  auto sortedPositions = [&layers](NodeIds neighbors) {
+    Vec<size_t> positions;
+    positions.reserve(neighbors.size());
+    for (size_t neighbor : neighbors) {
+      positions.push_back(layers.posOf(neighbor));
+    }
+    std::sort(positions.begin(), positions.end());
+    return positions;
+  };
+  Vec2<size_t> predPositions;
+  Vec2<size_t> succPositions;
+  predPositions.reserve(width);
+  succPositions.reserve(width);
+  for (size_t nId : nodes) {
+    predPositions.push_back(sortedPositions(index.preds(nId)));
+    succPositions.push_back(sortedPositions(index.succs(nId)));
+  }
+  auto crossings = [&predPositions, &succPositions](size_t left, size_t right) {
+    return pairCrossings(predPositions[left], predPositions[right])
+         + pairCrossings(succPositions[left], succPositions[right]);
+  };
+  // Crossings gained minus the ones lost when `left` moves from the right to the left of `right`
+  auto swapDelta = [&crossings](size_t left, size_t right) {
+    return static_cast<std::ptrdiff_t>(crossings(left, right))
+         - static_cast<std::ptrdiff_t>(crossings(right, left));
+  };
+  // order[pos] is the index in the neighbor positions of the node at pos
+  Vec<size_t> order(width);
+  std::iota(order.begin(), order.end(), 0);
+  bool moved = false;
+  for (size_t sifted = 0; sifted < width; ++sifted) {
+    size_t const nId = nodes[sifted];
+    size_t const curPos = layers.posOf(nId);
+    // The node goes before the slot-th of the other nodes, or after all of them
+    size_t minSlot = 0;
+    size_t maxSlot = width - 1;
+    for (size_t left : leftNodes[nId]) {
+      minSlot = std::max(minSlot, layers.posOf(left) + 1);
+    }
+    for (size_t right : rightNodes[nId]) {
+      maxSlot = std::min(maxSlot, layers.posOf(right) - 1);
+    }
+    assert(minSlot <= curPos && curPos <= maxSlot);
+    // Crossings relative to the node on the left of all the others
+    std::ptrdiff_t cost = 0;
+    std::ptrdiff_t curCost = 0;
+    std::ptrdiff_t bestCost = std::numeric_limits<std::ptrdiff_t>::max();
+    size_t bestSlot = curPos;
+    for (size_t slot = 0; slot <= maxSlot; ++slot) {
+      if (minSlot <= slot && cost < bestCost) {
+        bestCost = cost;
+        bestSlot = slot;
+      }
+      if (slot == curPos) {
+        curCost = cost;
+      }
+      if (slot < width - 1) {
+        size_t other = order[slot < curPos ? slot : slot + 1];
+        cost += swapDelta(other, sifted);
+      }
+    }
+    if (curCost <= bestCost) {
+      continue;
+    }
+    moved = true;
+    for (size_t pos = curPos; bestSlot < pos; --pos) {
+      layers.swapNeighbors(layerI, pos);
+      std::swap(order[pos - 1], order[pos]);
+    }
+    for (size_t pos = curPos + 1; pos <= bestSlot; ++pos) {
+      layers.swapNeighbors(layerI, pos);
+      std::swap(order[pos - 1], order[pos]);
+    }
+  }
+  return moved;
+}
+
+/// Sifts the layers top to bottom until no node moves.
+/// Every move removes a crossing, so this terminates.
+void siftNodes(Layering& layers, GraphIndex const& index, Vec2<size_t> const& leftNodes) {
+  Vec2<size_t> rightNodes(index.size());
+  for (size_t nId = 0; nId < leftNodes.size(); ++nId) {
+    for (size_t left : leftNodes[nId]) {
+      rightNodes[left].push_back(nId);
+    }
+  }
+  bool moved = true;
+  while (moved) {
+    moved = false;
+    for (size_t layerI = 0; layerI < layers.size(); ++layerI) {
+      moved = siftLayer(layers, index, layerI, leftNodes, rightNodes) || moved;
     }
   }
 }
@@ -1794,7 +3460,7 @@ string escapeForDOTlabel(string_view str) {
   return ret;
 }
 
-Vec<size_t> computeLayerHeights(Vec<Position> const& dimensions, Vec2<size_t> const& layers) {
+Vec<size_t> computeLayerHeights(Vec<Position> const& dimensions, Layering const& layers) {
   Vec<size_t> ret;
   ret.reserve(layers.size());
   for (auto const& layer : layers) {
@@ -1809,24 +3475,10 @@ Vec<size_t> computeLayerHeights(Vec<Position> const& dimensions, Vec2<size_t> co
 }
 
 [[maybe_unused]]
-Vec2<size_t> getAllSuccs(size_t node, DAG const& dag, Vec2<size_t> const& layers) {
-  size_t const N = dag.nodes.size();
-  Vec<size_t> pos(N, 0);
-  for (auto layer : layers) {
-    for (size_t nodeI = 0; nodeI < layer.size(); ++nodeI) {
-      pos[layer[nodeI]] = nodeI;
-    }
-  }
-  Vec2<size_t> preds(N);
-  // Enumerating nodes by layer to make sure preds[*] for each node have
-  // the same order as the layer they are on
-  for (size_t nodeI = 0; nodeI < N; ++nodeI) {
-    for (size_t succ : dag.nodes[nodeI].succs) {
-      preds[succ].push_back(nodeI);
-    }
-  }
+Vec2<size_t>
+getAllSuccs(size_t node, GraphIndex const& index, Layering const& layers) {
   Vec<std::tuple<Vec<size_t>, size_t, size_t>> unresolvedEdges;
-  for (size_t succ : dag.nodes[node].succs) {
+  for (size_t succ : index.succs(node)) {
     unresolvedEdges.emplace_back(Vec<size_t>{}, node, succ);
   }
 
@@ -1835,18 +3487,19 @@ Vec2<size_t> getAllSuccs(size_t node, DAG const& dag, Vec2<size_t> const& layers
     auto [prefix, from, to] = unresolvedEdges.back();
     prefix.push_back(from);
     unresolvedEdges.pop_back();
-    if (dag.nodes[to].text == waypointText) {
-      unresolvedEdges.emplace_back(prefix, to, dag.nodes[to].succs[0]);
+    if (index.kind(to) == NodeKind::Waypoint) {
+      unresolvedEdges.emplace_back(prefix, to, index.succs(to)[0]);
       continue;
     }
-    if (dag.nodes[to].text == "X") {
-      size_t otherPred = preds[to][0] == from ? preds[to][1] : preds[to][0];
-      size_t succLeft = dag.nodes[to].succs[0];
-      size_t succRight = dag.nodes[to].succs[1];
-      if (pos[succRight] < pos[succLeft]) {
+    if (index.kind(to) == NodeKind::Cross) {
+      auto preds = index.preds(to);
+      size_t otherPred = preds[0] == from ? preds[1] : preds[0];
+      size_t succLeft = index.succs(to)[0];
+      size_t succRight = index.succs(to)[1];
+      if (layers.posOf(succRight) < layers.posOf(succLeft)) {
         std::swap(succLeft, succRight);
       }
-      if (pos[otherPred] < pos[from]) {
+      if (layers.posOf(otherPred) < layers.posOf(from)) {
         unresolvedEdges.emplace_back(prefix, to, succLeft);
       } else {
         unresolvedEdges.emplace_back(prefix, to, succRight);
@@ -1856,347 +3509,1071 @@ Vec2<size_t> getAllSuccs(size_t node, DAG const& dag, Vec2<size_t> const& layers
     prefix.push_back(to);
     ret.push_back({to});
   }
-
-  return ret;
+
+  return ret;
+}
+
+} // namespace
+
+namespace detail {
+
+Vec<CrossingPair>
+findNonConflictingCrossings(GraphIndex const& index, Vec<size_t> const& lAbove, Vec<size_t> const& lBelow) {
+  LayerPositions const belowPositions(lBelow);
+  // For every node above, the distinct positions of its successors below, left to right.
+  // Every edge resolves at most one crossing, and the edges a node loses to the crossings
+  // of the nodes on its left are always its left-most ones, so the edges still available
+  // are the suffix starting at firstFree.
+  Vec2<size_t> succPositions(lAbove.size());
+  Vec<size_t> firstFree(lAbove.size(), 0);
+  Vec<size_t> leftMostFree(lAbove.size(), MinSegmentTree::infinity);
+  for (size_t topPos = 0; topPos < lAbove.size(); ++topPos) {
+    auto& positions = succPositions[topPos];
+    for (size_t succ : index.succs(lAbove[topPos])) {
+      if (auto pos = belowPositions.find(succ)) {
+        positions.push_back(*pos);
+      }
+    }
+    std::sort(positions.begin(), positions.end());
+    positions.erase(std::unique(positions.begin(), positions.end()), positions.end());
+    if (!positions.empty()) {
+      leftMostFree[topPos] = positions[0];
+    }
+  }
+  MinSegmentTree freeEdges(leftMostFree);
+
+  Vec<CrossingPair> ret;
+  // Sweeping from left to right to find the left-most crossing points
+  // for any node involved. This helps keeping the order of predecessors and successors
+  // for nodes when inserting the X nodes from left to right
+  for (size_t leftTopPos = 0; leftTopPos < lAbove.size(); ++leftTopPos) {
+    auto const& positions = succPositions[leftTopPos];
+    for (size_t succI = firstFree[leftTopPos]; succI < positions.size(); ++succI) {
+      size_t rightBottomPos = positions[succI];
+      // The closest node on the right with a free edge going left of rightBottom
+      auto rightTopPos = freeEdges.findFirstBelow(leftTopPos + 1, rightBottomPos);
+      if (!rightTopPos) {
+        continue;
+      }
+      size_t leftBottomPos = succPositions[*rightTopPos][firstFree[*rightTopPos]];
+      size_t nextFree = ++firstFree[*rightTopPos];
+      freeEdges.set(
+        *rightTopPos,
+        nextFree < succPositions[*rightTopPos].size() ? succPositions[*rightTopPos][nextFree]
+                                                      : MinSegmentTree::infinity
+      );
+      ret.push_back(
+        {lAbove[leftTopPos], lAbove[*rightTopPos], lBelow[leftBottomPos], lBelow[rightBottomPos]}
+      );
+    }
+  }
+  return ret;
+}
+
+size_t countCrossings(GraphIndex const& index, Vec<size_t> const& lAbove, Vec<size_t> const& lBelow) {
+  LayerPositions const belowPositions(lBelow);
+  return countBilayerCrossings(index, lAbove, lBelow.size(), [&belowPositions](size_t nodeId) {
+    auto pos = belowPositions.find(nodeId);
+    assert(pos.has_value() && "The node must be in this list");
+    return *pos;
+  });
+}
+
+size_t countCrossings(GraphIndex const& index, Layering const& layers, size_t upperLayerI) {
+  return countBilayerCrossings(
+    index,
+    layers[upperLayerI],
+    layers[upperLayerI + 1].size(),
+    [&layers](size_t nodeId) { return layers.posOf(nodeId); }
+  );
+}
+
+size_t insertEdgeWaypoint(GraphIndex& index, size_t from, size_t to) {
+  size_t nodeId = index.addNode(NodeKind::Waypoint, {1, 1}, {to});
+  index.replaceSucc(from, to, nodeId);
+  index.addPred(nodeId, from);
+  index.replacePred(to, from, nodeId);
+  return nodeId;
+}
+
+Vec<size_t> insertCrossesAndWaypointsBetween(
+  GraphIndex& index,
+  Vec<CrossingPair>&& crossings,
+  Layering const& layers,
+  size_t layerAboveI
+) {
+  Vec<size_t> insertedNodes;
+  assert(std::is_sorted(crossings.begin(), crossings.end(), [&](auto const& x1, auto const& x2) {
+    return std::make_pair(layers.posOf(x1.fromLeft), layers.posOf(x1.toRight))
+         < std::make_pair(layers.posOf(x2.fromLeft), layers.posOf(x2.toRight));
+  }));
+  // By the position in the layer above, the crossings already inserted on the left edges of a node
+  Vec2<size_t> rightLeftEdges(layers[layerAboveI].size());
+  auto nextCrossing = crossings.begin();
+  for (size_t n : layers[layerAboveI]) {
+    size_t handledSuccCount = rightLeftEdges[layers.posOf(n)].size();
+    for (size_t succI = handledSuccCount; succI < index.succs(n).size(); ++succI) {
+      size_t succ = index.succs(n)[succI];
+      if (nextCrossing != crossings.end() && n == nextCrossing->fromLeft && succ == nextCrossing->toRight) {
+        size_t insertedXNode = insertCrossNode(index, *nextCrossing);
+        assert(index.succs(n)[succI] == insertedXNode);
+        insertedNodes.push_back(insertedXNode);
+        auto& insertedEdgesOfRightNode = rightLeftEdges[layers.posOf(nextCrossing->fromRight)];
+        assert(
+          index.kind(nextCrossing->fromRight) != NodeKind::Cross
+          || insertedXNode == index.succs(nextCrossing->fromRight)[0]
+          || insertedEdgesOfRightNode.size() == 1
+        );
+        insertedEdgesOfRightNode.push_back(insertedXNode);
+        ++nextCrossing;
+        continue;
+      }
+      assert(!contains(rightLeftEdges[layers.posOf(n)], succ));
+      size_t insertedWaypoint = insertEdgeWaypoint(index, n, succ);
+      insertedNodes.push_back(insertedWaypoint);
+      assert(index.succs(n)[succI] == insertedWaypoint);
+    }
+  }
+  assert(nextCrossing == crossings.end());
+  return insertedNodes;
+}
+
+Layering insertCrossNodes(GraphIndex& index, Layering const& layers) {
+  assert(wellLayered(index, layers));
+  assert(succsSameOrderAsLayers(index, layers));
+  Layering newLayers;
+  newLayers.appendLayer(layers[0]);
+  for (size_t layerI = 1; layerI < layers.size(); ++layerI) {
+    auto crossings = findNonConflictingCrossings(index, layers[layerI - 1], layers[layerI]);
+    if (!crossings.empty()) {
+      newLayers.appendLayer(
+        insertCrossesAndWaypointsBetween(index, std::move(crossings), layers, layerI - 1)
+      );
+    }
+    newLayers.appendLayer(layers[layerI]);
+  }
+  assert(wellLayered(index, newLayers));
+  assert(succsSameOrderAsLayers(index, newLayers));
+  return newLayers;
+}
+
+void minimizeCrossings(Layering& layers, GraphIndex& index, RenderOptions const& options) {
+  assert(succsSameOrderAsLayers(index, layers));
+  // Keep track of the nodes connected to the "X" cross nodes
+  // so that this shuffling does not accidentally change the meaning of the crossing
+  Vec2<size_t> const leftNodes = findForcedLeftNodesBecauseOfCrossings(index, layers);
+  auto const heuristic = options.crossingHeuristic;
+  if (options.maxSweeps == 0) {
+    minimizeCrossingsForward(layers, index, leftNodes, heuristic);
+    LOGDAGL(dag, index, layers, "after first forward");
+    minimizeCrossingsBackward(layers, index, leftNodes, heuristic);
+    LOGDAGL(dag, index, layers, "after backward");
+    minimizeCrossingsForward(layers, index, leftNodes, heuristic);
+  } else {
+    // A sweep never adds crossings, so stop once a down and an up sweep in a row removed none
+    size_t crossings = countAllCrossings(layers, index);
+    size_t fruitlessSweeps = 0;
+    for (size_t sweep = 0; sweep < options.maxSweeps && 0 < crossings && fruitlessSweeps < 2;
+         ++sweep) {
+      if (sweep % 2 == 0) {
+        minimizeCrossingsForward(layers, index, leftNodes, heuristic);
+      } else {
+        minimizeCrossingsBackward(layers, index, leftNodes, heuristic);
+      }
+      size_t remaining = countAllCrossings(layers, index);
+      assert(remaining <= crossings);
+      fruitlessSweeps = remaining < crossings ? 0 : fruitlessSweeps + 1;
+      crossings = remaining;
+    }
+  }
+  switch (options.crossingReduction) {
+    case RenderOptions::CrossingReduction::Sweeps:
+      break;
+    case RenderOptions::CrossingReduction::Sifting:
+      siftNodes(layers, index, leftNodes);
+      break;
+  }
+  sortSuccsAsLayers(index, layers);
+  assert(succsSameOrderAsLayers(index, layers));
+}
+
+bool drawEdge(
+  Position fromPos,
+  Direction exitDir,
+  Position to,
+  Direction entryDir,
+  Canvas& canvas
+) {
+  assert(fromPos.line + 1 < to.line && to.line < canvas.height());
+  assert(fromPos.col < canvas.width() && to.col < canvas.width());
+
+  auto first = nextPosInDir(fromPos, exitDir, exitDir);
+  if (!canvas.inBounds(first)) {
+    return false;
+  }
+  if (first.line + 1 == to.line) {
+    if (exitDir != entryDir) {
+      return false;
+    }
+    canvas.newMark(first, edgeChar(exitDir));
+    return true;
+  }
+
+  auto path = routeEdge(first, exitDir, to, entryDir, canvas);
+  if (!path) {
+    return false;
+  }
+  for (auto const& step : *path) {
+    canvas.newMark(step.pos, edgeChar(step.dir));
+  }
+  to.line -= 1;
+  to.col -= directionShift(entryDir);
+  canvas.newMark(to, edgeChar(entryDir));
+  return true;
+}
+
+std::optional<RenderError>
+layerDAG(GraphIndex& index, Layering& layers, RenderOptions const& options) {
+  if (auto cycleErr = dagLayers(index, layers)) {
+    return cycleErr;
+  }
+  switch (options.layerAssignment) {
+    case RenderOptions::LayerAssignment::LongestPath:
+      break;
+    case RenderOptions::LayerAssignment::WidthBounded:
+      layers = widthBoundedLayers(index, options.maxLayerWidth);
+      break;
+    case RenderOptions::LayerAssignment::MinimumSpan:
+      layers = layeringFromRanks(MinimumSpanRanking(index, layers).solve());
+      break;
+  }
+  return insertEdgeWaypoints(index, layers);
+}
+
+namespace {
+
+size_t maxThreads(RenderOptions const& options) {
+  if (options.threads != 0) {
+    return options.threads;
+  }
+  return std::max(1U, std::thread::hardware_concurrency());
+}
+
+/// Draws all the nodes and all the edges it can route,
+/// reporting the first edge it could not route in routingErr
+Canvas drawLayout(
+  NodeLabels const& labels,
+  GraphIndex const& index,
+  Layering const& layers,
+  RenderOptions const& options,
+  std::optional<RenderError>& routingErr
+) {
+  auto const& dimensions = index.dimensions();
+  auto coords = computeNodeCoordinates(layers, dimensions);
+  auto connectivity = computeConnectivity(index, coords);
+  Vec<size_t> movedNodes;
+  auto layerHeights = computeLayerHeights(dimensions, layers);
+  for (int i = 0; i < 5; ++i) {
+    bool moved = adjustCoordsWithValencies(
+      coords, connectivity, layers, dimensions, layerHeights, movedNodes
+    );
+    if (!moved) {
+      break;
+    }
+    // Reposition edges to account for the changes in positions
+    updateConnectivity(connectivity, index, coords, movedNodes);
+    assert(connectivityMatches(connectivity, computeConnectivity(index, coords)));
+  }
+  if (options.placement == RenderOptions::Placement::MedianAligned) {
+    alignWithMedians(index, layers, coords, connectivity);
+    assert(connectivityMatches(connectivity, computeConnectivity(index, coords)));
+    // The straighter edges can need fewer lines between the layers
+    stackLayers(coords, connectivity, layers, layerHeights);
+  }
+  auto canvas = Canvas::create(coords, dimensions);
+  placeNodes(labels, index, coords, canvas);
+  routingErr = placeEdges(coords, dimensions, layers, layerHeights, connectivity, maxThreads(options), canvas);
+  return canvas;
+}
+
+} // namespace
+
+std::optional<string> renderDAGWithLayers(
+  DAG const& dag,
+  GraphIndex const& index,
+  Layering const& layers,
+  RenderError& err,
+  RenderOptions const& options
+) {
+  std::optional<RenderError> routingErr;
+  auto canvas = drawLayout(labelsOf(dag), index, layers, options, routingErr);
+  if (routingErr) {
+    err = *routingErr;
+    return std::nullopt;
+  }
+  return canvas.render();
+}
+
+std::string renderDAGWithLayers(
+  DAG const& dag,
+  GraphIndex const& index,
+  Layering const& layers,
+  RenderOptions const& options
+) {
+  std::optional<RenderError> routingErr;
+  return drawLayout(labelsOf(dag), index, layers, options, routingErr).render();
+}
+
+namespace {
+
+bool isNodeChar(char c) {
+  return c != ' ' && c != '\n' && !edgeChar(c).has_value();
+}
+
+#if defined(__SSE2__)
+/// Bit i is set iff bytes[i] == c
+int byteMask(__m128i bytes, char c) {
+  return _mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8(c)));
+}
+#endif
+
+} // namespace
+
+size_t countLeadingSpaces(string_view str) {
+  size_t i = 0;
+#if defined(__SSE2__)
+  for (; i + 16 <= str.size(); i += 16) {
+    auto bytes = _mm_loadu_si128(reinterpret_cast<__m128i const*>(str.data() + i));
+    if (int notSpace = ~byteMask(bytes, ' ') & 0xFFFF) {
+      return i + static_cast<size_t>(__builtin_ctz(notSpace));
+    }
+  }
+#endif
+  while (i < str.size() && str[i] == ' ') {
+    ++i;
+  }
+  return i;
+}
+
+size_t countLeadingNodeChars(string_view str) {
+  size_t i = 0;
+#if defined(__SSE2__)
+  for (; i + 16 <= str.size(); i += 16) {
+    auto bytes = _mm_loadu_si128(reinterpret_cast<__m128i const*>(str.data() + i));
+    int stop = byteMask(bytes, ' ') | byteMask(bytes, '\n') | byteMask(bytes, '|')
+             | byteMask(bytes, '/') | byteMask(bytes, '\\');
+    if (stop != 0) {
+      return i + static_cast<size_t>(__builtin_ctz(stop));
+    }
+  }
+#endif
+  while (i < str.size() && isNodeChar(str[i])) {
+    ++i;
+  }
+  return i;
+}
+
+} // namespace detail
+
+namespace {
+
+/// Lays out and draws a DAG as one piece,
+/// inserting the waypoint and crossing nodes into its GraphIndex only
+std::optional<Canvas> drawConnectedDAG(
+  GraphIndex index,
+  NodeLabels const& labels,
+  RenderError& err,
+  RenderOptions const& options
+) {
+  if (auto crowdedErr = checkIfEdgesFitOnNodes(index)) {
+    err = *crowdedErr;
+    return {};
+  }
+  size_t const nOriginalNodes = index.size();
+  Layering layers;
+  if (auto layeringErr = layerDAG(index, layers, options)) {
+    err = *layeringErr;
+    return {};
+  }
+
+  LOGDAGL(labels, index, layers, "before min crossings");
+  minimizeCrossings(layers, index, options);
+  LOGDAGL(labels, index, layers, "after min crossings");
+
+  for (int i = 0; i < 16; ++i) {
+    if (countAllCrossings(layers, index) == 0) {
+      break;
+    }
+    layers = insertCrossNodes(index, layers);
+    LOGDAGL(labels, index, layers, "after insert X");
+    minimizeCrossings(layers, index, options);
+    LOGDAGL(labels, index, layers, "after min crossing in the loop");
+    assert(succsSameOrderAsLayers(index, layers));
+  }
+
+  std::optional<RenderError> routingErr;
+  auto canvas = drawLayout(labels, index, layers, options, routingErr);
+  if (routingErr) {
+    err = *routingErr;
+    err.nodeId = originalSource(index, nOriginalNodes, err.nodeId);
+    return {};
+  }
+  return canvas;
+}
+
+/// Nodes of every weakly connected component in increasing order,
+/// the components ordered by their first nodes
+Vec2<size_t> weakComponents(GraphIndex const& index) {
+  Vec<size_t> parent(index.size());
+  std::iota(parent.begin(), parent.end(), 0);
+  auto find = [&parent](size_t n) {
+    while (parent[n] != n) {
+      parent[n] = parent[parent[n]];
+      n = parent[n];
+    }
+    return n;
+  };
+  for (size_t n = 0; n < index.size(); ++n) {
+    for (size_t succ : index.succs(n)) {
+      size_t a = find(n);
+      size_t b = find(succ);
+      parent[std::max(a, b)] = std::min(a, b);
+    }
+  }
+  Vec2<size_t> ret;
+  Vec<size_t> componentOf(index.size());
+  for (size_t n = 0; n < index.size(); ++n) {
+    size_t root = find(n);
+    if (root == n) {
+      componentOf[n] = ret.size();
+      ret.emplace_back();
+    }
+    componentOf[n] = componentOf[root];
+    ret[componentOf[n]].push_back(n);
+  }
+  return ret;
+}
+
+/// The subgraph induced by the nodes of a weakly connected component,
+/// with the ids renumbered by the positions in `nodes`
+GraphIndex componentIndex(GraphIndex const& index, Vec<size_t> const& nodes) {
+  Vec<size_t> localId(index.size(), 0);
+  for (size_t i = 0; i < nodes.size(); ++i) {
+    localId[nodes[i]] = i;
+  }
+  Vec<size_t> succBegin;
+  Vec<size_t> succIds;
+  Vec<Position> dimensions;
+  succBegin.reserve(nodes.size() + 1);
+  dimensions.reserve(nodes.size());
+  for (size_t n : nodes) {
+    succBegin.push_back(succIds.size());
+    for (size_t succ : index.succs(n)) {
+      succIds.push_back(localId[succ]);
+    }
+    dimensions.push_back(index.dimensions()[n]);
+  }
+  succBegin.push_back(succIds.size());
+  return GraphIndex::fromCSR(std::move(succBegin), std::move(succIds), std::move(dimensions));
+}
+
+NodeLabels componentLabels(NodeLabels const& labels, Vec<size_t> const& nodes) {
+  NodeLabels ret;
+  ret.reserve(nodes.size());
+  for (size_t n : nodes) {
+    ret.push_back(labels[n]);
+  }
+  return ret;
+}
+
+/// Places the drawings left to right, top-aligned, with a blank column between them.
+/// A drawing that would reach past maxWidth (if not 0) starts a new row of drawings,
+/// a blank line below the previous one.
+Canvas packSideBySide(Vec<Canvas> const& drawings, size_t maxWidth) {
+  Vec<Position> topLefts;
+  Position next{0, 0};
+  size_t rowHeight = 0;
+  Position size{0, 0};
+  for (auto const& drawing : drawings) {
+    if (maxWidth != 0 && 0 < next.col && maxWidth < next.col + drawing.usedWidth()) {
+      next = {next.line + rowHeight + 1, 0};
+      rowHeight = 0;
+    }
+    topLefts.push_back(next);
+    size.col = std::max(size.col, next.col + drawing.usedWidth());
+    size.line = std::max(size.line, next.line + drawing.height());
+    rowHeight = std::max(rowHeight, drawing.height());
+    next.col += drawing.usedWidth() + 1;
+  }
+  auto ret = Canvas::blank(size.col, size.line);
+  for (size_t i = 0; i < drawings.size(); ++i) {
+    ret.paste(drawings[i], topLefts[i]);
+  }
+  return ret;
+}
+
+/// Lays out and draws a non-empty DAG with no empty labels
+std::optional<Canvas>
+drawIndexedDAG(GraphIndex index, NodeLabels const& labels, RenderError& err, RenderOptions const& options) {
+  auto const components = weakComponents(index);
+  if (components.size() == 1) {
+    return drawConnectedDAG(std::move(index), labels, err, options);
+  }
+
+  // Disconnected parts share nothing, so they are laid out independently and concurrently
+  size_t const nThreads = std::min(maxThreads(options), components.size());
+  RenderOptions componentOptions = options;
+  if (1 < nThreads) {
+    componentOptions.threads = 1;
+  }
+  // Biggest first, so that no big component starts last
+  Vec<size_t> schedule(components.size());
+  std::iota(schedule.begin(), schedule.end(), 0);
+  std::stable_sort(schedule.begin(), schedule.end(), [&components](size_t a, size_t b) {
+    return components[b].size() < components[a].size();
+  });
+  Vec<std::optional<Canvas>> drawings(components.size());
+  Vec<RenderError> errs(components.size());
+  std::atomic<size_t> next{0};
+  auto drawComponents = [&]() {
+    for (size_t i = next++; i < schedule.size(); i = next++) {
+      size_t c = schedule[i];
+      errs[c].code = RenderError::Code::None;
+      drawings[c] = drawConnectedDAG(
+        componentIndex(index, components[c]),
+        componentLabels(labels, components[c]),
+        errs[c],
+        componentOptions
+      );
+    }
+  };
+  runOnThreads(nThreads, drawComponents);
+
+  Vec<Canvas> canvases;
+  canvases.reserve(components.size());
+  for (size_t c = 0; c < components.size(); ++c) {
+    if (!drawings[c]) {
+      err = errs[c];
+      err.nodeId = components[c][err.nodeId];
+      return {};
+    }
+    canvases.push_back(std::move(*drawings[c]));
+  }
+  return packSideBySide(canvases, options.maxWidth);
+}
+
+GraphIndex indexOf(DAG const& dag, NodeLabels const&) {
+  return GraphIndex(dag);
+}
+
+GraphIndex indexOf(CompactDAG const& dag, NodeLabels const& labels) {
+  Vec<size_t> succBegin;
+  Vec<size_t> succIds;
+  Vec<Position> dimensions;
+  succBegin.reserve(dag.size() + 1);
+  succIds.reserve(dag.edgeCount());
+  dimensions.reserve(dag.size());
+  for (CompactDAG::Id n = 0; n < dag.size(); ++n) {
+    succBegin.push_back(succIds.size());
+    auto const succs = dag.succs(n);
+    succIds.insert(succIds.end(), succs.begin(), succs.end());
+    dimensions.push_back(labelDimensions(labels[n]));
+  }
+  succBegin.push_back(succIds.size());
+  return GraphIndex::fromCSR(std::move(succBegin), std::move(succIds), std::move(dimensions));
+}
+
+/// Lays out and draws a DAG or a CompactDAG
+template <typename Graph>
+std::optional<Canvas> drawDAG(Graph const& dag, RenderError& err, RenderOptions const& options) {
+  auto const labels = labelsOf(dag);
+  if (labels.empty()) {
+    return Canvas::blank(0, 0);
+  }
+  if (auto compatErr = checkDAGCompat(labels)) {
+    err = *compatErr;
+    return {};
+  }
+  return drawIndexedDAG(indexOf(dag, labels), labels, err, options);
+}
+
+} // namespace
+
+namespace detail {
+
+std::optional<string> renderUnsplitDAG(DAG const& dag, RenderError& err, RenderOptions const& options) {
+  auto canvas = drawConnectedDAG(GraphIndex(dag), labelsOf(dag), err, options);
+  if (!canvas) {
+    return std::nullopt;
+  }
+  return canvas->render();
+}
+
+} // namespace detail
+
+namespace {
+
+/// Forwards to upstream, counting the bytes requested with room for their alignment
+class CountingResource : public std::pmr::memory_resource {
+public:
+  explicit CountingResource(std::pmr::memory_resource* upstream) : upstream(upstream) {}
+
+  size_t requested() const { return total; }
+
+private:
+  void* do_allocate(size_t bytes, size_t alignment) override {
+    total += bytes + alignment;
+    return upstream->allocate(bytes, alignment);
+  }
+  void do_deallocate(void* p, size_t bytes, size_t alignment) override {
+    upstream->deallocate(p, bytes, alignment);
+  }
+  bool do_is_equal(std::pmr::memory_resource const& other) const noexcept override {
+    return this == &other;
+  }
+
+  std::pmr::memory_resource* upstream;
+  size_t total = 0;
+};
+
+/// Pools blocks up to the largest size the standard library pools,
+/// bigger blocks come straight from the buffer and are not reused within a render
+std::pmr::pool_options arenaPoolOptions() {
+  std::pmr::pool_options ret;
+  ret.largest_required_pool_block = size_t{1} << 22;
+  return ret;
+}
+
+} // namespace
+
+namespace detail {
+
+namespace {
+thread_local std::pmr::memory_resource* currentScratch = nullptr;
+} // namespace
+
+std::pmr::memory_resource* scratchResource() {
+  return currentScratch != nullptr ? currentScratch : std::pmr::new_delete_resource();
+}
+
+/// Makes the containers created on this thread allocate from resource while in scope
+class ScratchScope {
+public:
+  explicit ScratchScope(std::pmr::memory_resource* resource) : outer(currentScratch) {
+    currentScratch = resource;
+  }
+  ~ScratchScope() { currentScratch = outer; }
+  ScratchScope(ScratchScope const&) = delete;
+  ScratchScope& operator=(ScratchScope const&) = delete;
+
+private:
+  std::pmr::memory_resource* outer;
+};
+
+} // namespace detail
+
+namespace {
+
+template <typename Graph>
+std::optional<string> renderAnyDAG(Graph const& dag, RenderError& err, RenderOptions const& options) {
+  err.code = RenderError::Code::None;
+  auto canvas = drawDAG(dag, err, options);
+  if (!canvas) {
+    return {};
+  }
+  return canvas->render();
 }
 
 } // namespace
 
-namespace detail {
+std::optional<string> renderDAG(DAG const& dag, RenderError& err, RenderOptions const& options) {
+  return renderAnyDAG(dag, err, options);
+}
 
-Vec<CrossingPair>
-findNonConflictingCrossings(DAG const& dag, Vec<size_t> const& lAbove, Vec<size_t> const& lBelow) {
-  Vec<CrossingPair> ret;
-  std::unordered_set<SimpleEdge, SimpleEdgeHash> takenEdges;
-  // TODO: These 5 nested loops can definitely be optmized
-  // Moving from left to right to find the left-most crossing points
-  // for any node involved. This helps keeping the order of predecessors and successors
-  // for nodes when inserting the X nodes from left to right
-  for (size_t leftTopPos = 0; leftTopPos < lAbove.size(); ++leftTopPos) {
-    auto leftTop = lAbove[leftTopPos];
-    for (size_t rightBottomPos = 1; rightBottomPos < lBelow.size(); ++rightBottomPos) {
-      auto rightBottom = lBelow[rightBottomPos];
-      SimpleEdge leftRightEdge{leftTop, rightBottom};
-      if (!contains(dag.nodes[leftTop].succs, rightBottom) || takenEdges.count(leftRightEdge)) {
-        continue;
-      }
-      bool found = false;
-      for (size_t rightTopPos = leftTopPos + 1; rightTopPos < lAbove.size(); ++rightTopPos) {
-        auto rightTop = lAbove[rightTopPos];
-        for (size_t leftBottomPos = 0; leftBottomPos < rightBottomPos; ++leftBottomPos) {
-          auto leftBottom = lBelow[leftBottomPos];
-          SimpleEdge rightLeftEdge{rightTop, leftBottom};
-          if (!contains(dag.nodes[rightTop].succs, leftBottom)) {
-            continue;
-          }
-          if (takenEdges.count(rightLeftEdge) == 0) {
-            takenEdges.insert(rightLeftEdge);
-            takenEdges.insert(leftRightEdge);
-            ret.push_back({leftTop, rightTop, leftBottom, rightBottom});
-            found = true;
-            break;
-          }
-        }
-        if (found) {
-          // For any edge
-          // can only resolve one crossing at a time
-          break;
-        }
-      }
+/// The arena buffer, sized after the biggest render so far, and the reused output
+class RenderContext::State {
+public:
+  std::unique_ptr<std::byte[]> buffer;
+  size_t bufferSize = 0;
+  string output;
+};
+
+RenderContext::RenderContext() : state(std::make_unique<State>()) {}
+RenderContext::~RenderContext() = default;
+RenderContext::RenderContext(RenderContext&&) noexcept = default;
+RenderContext& RenderContext::operator=(RenderContext&&) noexcept = default;
+
+std::optional<string_view>
+renderDAG(DAG const& dag, RenderContext& ctx, RenderError& err, RenderOptions const& options) {
+  err.code = RenderError::Code::None;
+  auto& state = *ctx.state;
+  size_t arenaUse = 0;
+  {
+    std::pmr::monotonic_buffer_resource buffer(state.buffer.get(), state.bufferSize);
+    // The pool only goes to the buffer for more chunks and never gives them back before
+    // the end of the render, so this counts all the buffer must hold
+    CountingResource chunks(&buffer);
+    // Recycles what the render frees, so the buffer holds about the peak in use
+    // rather than everything the render ever allocated
+    std::pmr::unsynchronized_pool_resource arena(arenaPoolOptions(), &chunks);
+    detail::ScratchScope scope(&arena);
+
+    auto canvas = drawDAG(dag, err, options);
+    if (canvas) {
+      canvas->renderTo(state.output);
     }
+    arena.release();
+    arenaUse = chunks.requested();
   }
-  return ret;
+  if (state.bufferSize < arenaUse) {
+    // Next time everything fits in the buffer
+    state.buffer.reset(new std::byte[arenaUse]);
+    state.bufferSize = arenaUse;
+  }
+  if (err.code != RenderError::Code::None) {
+    return {};
+  }
+  return string_view(state.output);
 }
 
-size_t countCrossings(DAG const& dag, Vec<size_t> const& lAbove, Vec<size_t> const& lBelow) {
-  size_t ret = 0;
-  // TODO: These 5 nested loops can definitely be optmized
-  for (size_t leftTopPos = 0; leftTopPos < lAbove.size(); ++leftTopPos) {
-    for (size_t rightTopPos = leftTopPos + 1; rightTopPos < lAbove.size(); ++rightTopPos) {
-      for (size_t rightBottom : dag.nodes[lAbove[leftTopPos]].succs) {
-        for (size_t leftBottom : dag.nodes[lAbove[rightTopPos]].succs) {
-          if (findIndex(lBelow, leftBottom) < findIndex(lBelow, rightBottom)) {
-            ++ret;
-          }
-        }
-      }
+std::optional<string> renderDAG(CompactDAG const& dag, RenderError& err, RenderOptions const& options) {
+  return renderAnyDAG(dag, err, options);
+}
+
+namespace detail {
+
+std::optional<string> compactDAGOverflow(size_t nNodes, size_t nEdges, size_t labelBytes) {
+  auto const limit = size_t{std::numeric_limits<CompactDAG::Id>::max()};
+  auto const counts = {std::pair{nNodes, "nodes"}, {nEdges, "edges"}, {labelBytes, "label bytes"}};
+  for (auto [count, what] : counts) {
+    if (limit < count) {
+      return std::to_string(count) + " " + what + " do not fit in 32-bit ids";
     }
   }
-  return ret;
+  return std::nullopt;
 }
 
+} // namespace detail
 
-size_t insertEdgeWaypoint(DAG& dag, size_t from, size_t to) {
-  size_t nodeId = dag.nodes.size();
-  dag.nodes.push_back({{to}, waypointText});
-  replace(dag.nodes[from].succs, to, nodeId);
-  return nodeId;
+std::optional<CompactDAG> CompactDAG::fromDAG(DAG const& dag, ParseError& err) {
+  err.code = ParseError::Code::None;
+  size_t nEdges = 0;
+  size_t labelBytes = 0;
+  for (auto const& node : dag.nodes) {
+    nEdges += node.succs.size();
+    labelBytes += node.text.size();
+  }
+  if (auto overflow = detail::compactDAGOverflow(dag.nodes.size(), nEdges, labelBytes)) {
+    err = ParseError{ParseError::Code::TooLarge, *overflow, {0, 0}};
+    return std::nullopt;
+  }
+  std::vector<Id> succOffsets;
+  std::vector<Id> succTargets;
+  string labels;
+  std::vector<Id> labelOffsets;
+  succOffsets.reserve(dag.nodes.size() + 1);
+  succTargets.reserve(nEdges);
+  labels.reserve(labelBytes);
+  labelOffsets.reserve(dag.nodes.size() + 1);
+  for (auto const& node : dag.nodes) {
+    succOffsets.push_back(static_cast<Id>(succTargets.size()));
+    for (size_t succ : node.succs) {
+      succTargets.push_back(static_cast<Id>(succ));
+    }
+    labelOffsets.push_back(static_cast<Id>(labels.size()));
+    labels += node.text;
+  }
+  succOffsets.push_back(static_cast<Id>(succTargets.size()));
+  labelOffsets.push_back(static_cast<Id>(labels.size()));
+  return fromCSR(
+    std::move(succOffsets),
+    std::move(succTargets),
+    std::move(labels),
+    std::move(labelOffsets)
+  );
 }
 
-Vec<size_t> insertCrossesAndWaypointsBetween(
-  DAG& dag,
-  Vec<CrossingPair>&& crossings,
-  Vec<size_t> layerAbove,
-  Vec<size_t> curLayer
+CompactDAG CompactDAG::fromCSR(
+  std::vector<Id> succOffsets,
+  std::vector<Id> succTargets,
+  string labels,
+  std::vector<Id> labelOffsets
 ) {
-  Vec<size_t> insertedNodes;
-  assert(std::is_sorted(crossings.begin(), crossings.end(), [&](auto const& x1, auto const& x2) {
-    return std::make_pair(findIndex(layerAbove, x1.fromLeft), findIndex(curLayer, x1.toRight))
-         < std::make_pair(findIndex(layerAbove, x2.fromLeft), findIndex(curLayer, x2.toRight));
-  }));
-  std::unordered_map<size_t, Vec<size_t>> rightLeftEdges;
-  auto nextCrossing = crossings.begin();
-  for (size_t n : layerAbove) {
-    size_t handledSuccCount = rightLeftEdges[n].size();
-    for (size_t succI = handledSuccCount; succI < dag.nodes[n].succs.size(); ++succI) {
-      size_t succ = dag.nodes[n].succs[succI];
-      if (nextCrossing != crossings.end() && n == nextCrossing->fromLeft && succ == nextCrossing->toRight) {
-        size_t insertedXNode = insertCrossNode(dag, *nextCrossing);
-        assert(dag.nodes[n].succs[succI] == insertedXNode);
-        insertedNodes.push_back(insertedXNode);
-        auto& insertedEdgesOfRightNode = rightLeftEdges[nextCrossing->fromRight];
-        assert(
-          dag.nodes[nextCrossing->fromRight].text != "X"
-          || insertedXNode == dag.nodes[nextCrossing->fromRight].succs[0]
-          || insertedEdgesOfRightNode.size() == 1
-        );
-        insertedEdgesOfRightNode.push_back(insertedXNode);
-        ++nextCrossing;
-        continue;
-      }
-      assert(!contains(rightLeftEdges[n], succ));
-      size_t insertedWaypoint = insertEdgeWaypoint(dag, n, succ);
-      insertedNodes.push_back(insertedWaypoint);
-      assert(dag.nodes[n].succs[succI] == insertedWaypoint);
-    }
-  }
-  assert(nextCrossing == crossings.end());
-  return insertedNodes;
+  assert(!succOffsets.empty() && succOffsets.back() == succTargets.size());
+  assert(labelOffsets.size() == succOffsets.size() && labelOffsets.back() == labels.size());
+  CompactDAG ret;
+  ret.succOffsets = std::move(succOffsets);
+  ret.succTargets = std::move(succTargets);
+  ret.labels = std::move(labels);
+  ret.labelOffsets = std::move(labelOffsets);
+  ret.computePreds();
+  return ret;
 }
 
-Vec2<size_t> insertCrossNodes(DAG& dag, Vec2<size_t> const& layers) {
-  assert(wellLayered(dag, layers));
-  assert(succsSameOrderAsLayers(dag, layers));
-  Vec2<size_t> newLayers;
-  newLayers.push_back(layers[0]);
-  for (size_t layerI = 1; layerI < layers.size(); ++layerI) {
-    auto const& curLayer = layers[layerI];
-    auto const& layerAbove = layers[layerI - 1];
-    auto crossings = findNonConflictingCrossings(dag, layerAbove, curLayer);
-    if (!crossings.empty()) {
-      newLayers.emplace_back(
-        insertCrossesAndWaypointsBetween(dag, std::move(crossings), layerAbove, curLayer)
-      );
+void CompactDAG::computePreds() {
+  // Counting sort of the edges by their target keeps the sources in increasing order
+  predOffsets.assign(size() + 1, 0);
+  for (Id target : succTargets) {
+    assert(target < size());
+    ++predOffsets[target + 1];
+  }
+  std::partial_sum(predOffsets.begin(), predOffsets.end(), predOffsets.begin());
+  predSources.resize(succTargets.size());
+  Vec<Id> next(predOffsets.begin(), predOffsets.end() - 1);
+  for (Id from = 0; from < size(); ++from) {
+    for (Id to : succs(from)) {
+      predSources[next[to]++] = from;
     }
-    newLayers.push_back(curLayer);
   }
-  assert(wellLayered(dag, newLayers));
-  assert(succsSameOrderAsLayers(dag, newLayers));
-  return newLayers;
 }
 
-void minimizeCrossings(Vec2<size_t>& layers, DAG& dag) {
-  assert(succsSameOrderAsLayers(dag, layers));
-  Vec2<size_t> preds(dag.nodes.size());
-  // Enumerating nodes by layer to make sure preds[*] for each node have
-  // the same order as the layer they are on
-  for (auto const& layer : layers) {
-    for (auto nId : layer) {
-      for (auto succ : dag.nodes[nId].succs) {
-        preds[succ].push_back(nId);
-      }
-    }
-  }
-  // Keep track of the nodes connected to the "X" cross nodes
-  // so that this shuffling does not accidentally change the meaning of the crossing
-  Vec2<size_t> const leftNodes = findForcedLeftNodesBecauseOfCrossings(dag, preds);
-  minimizeCrossingsForward(layers, dag, preds, leftNodes);
-  LOGDAGL(dag, layers, "after first forward");
-  minimizeCrossingsBackward(layers, dag, preds, leftNodes);
-  LOGDAGL(dag, layers, "after backward");
-  minimizeCrossingsForward(layers, dag, preds, leftNodes);
-  sortSuccsAsLayers(dag, layers);
-  assert(succsSameOrderAsLayers(dag, layers));
+CompactDAG::Ids CompactDAG::range(std::vector<Id> const& offsets, std::vector<Id> const& ids, Id node) {
+  assert(node + 1U < offsets.size());
+  return {ids.data() + offsets[node], ids.data() + offsets[node + 1]};
 }
 
-bool drawEdge(
-  Position fromPos,
-  Direction exitDir,
-  Position to,
-  Direction entryDir,
-  Canvas& canvas
-) {
-  assert(fromPos.line + 1 < to.line && to.line < canvas.height());
-  assert(fromPos.col < canvas.width() && to.col < canvas.width());
+string_view CompactDAG::text(Id node) const {
+  assert(node + 1U < labelOffsets.size());
+  return string_view(labels).substr(labelOffsets[node], labelOffsets[node + 1] - labelOffsets[node]);
+}
+
+DAG CompactDAG::toDAG() const {
+  DAG ret;
+  ret.nodes.resize(size());
+  for (Id node = 0; node < size(); ++node) {
+    auto nodeSuccs = succs(node);
+    ret.nodes[node].succs.assign(nodeSuccs.begin(), nodeSuccs.end());
+    ret.nodes[node].text = text(node);
+  }
+  return ret;
+}
 
-  Vec<EdgeStep> drawnPath;
-  drawnPath.emplace_back();
-  drawnPath.back().initialPos = fromPos;
-  drawnPath.back().initialDir = exitDir;
-  drawnPath.back().nextDir = exitDir;
-  fromPos = nextPosInDir(fromPos, exitDir, exitDir);
-  canvas.newMark(fromPos, edgeChar(exitDir));
-  drawnPath.back().markedPos = fromPos;
+/// The parsing state that must survive between chunks:
+/// only the current and the previous lines are kept in addition to the nodes found so far
+class ParseSession::State {
+public:
+  explicit State(bool keepText) : collector(keepText) {}
 
-  if (fromPos.line + 1 == to.line) {
-    return exitDir == entryDir;
+  std::optional<ParseError> consume(char c);
+  size_t consumeRun(string_view rest);
+  std::optional<ParseError> finish();
+  /// Records and returns the first error of the whole input, if any
+  std::optional<ParseError> conclude();
+  /// Prepares for a new input, keeping the storage
+  void reset(bool keepText);
+  DAG buildDAG() && { return std::move(collector).buildDAG(); }
+  SourceDAG buildSourceDAG(string_view source) && {
+    return std::move(collector).buildSourceDAG(source);
+  }
+  std::optional<CompactDAG> buildCompactDAG(string_view source, ParseError& err) && {
+    return std::move(collector).buildCompactDAG(source, err);
   }
 
-  bool succeded = false;
-  do {
-    eraseAndBacktrackToLastChoice(drawnPath, canvas);
-    succeded = tryDrawLine(to, entryDir, canvas, drawnPath);
-  } while (!succeded && !drawnPath.empty());
+  std::optional<ParseError> err;
 
-  to.line -= 1;
-  to.col -= directionShift(entryDir);
-  canvas.newMark(to, edgeChar(entryDir));
-  return succeded;
-}
+private:
+  NodeCollector collector;
+  EdgesInFlight prevEdges;
+  EdgesInFlight currEdges;
+  Position pos{0, 0};
+};
 
-Vec<size_t> computeIdToLayerMap(Vec2<size_t> const& layers, size_t nNodes) {
-  Vec<size_t> ret;
-  ret.resize(nNodes);
-  for (size_t i = 0; i < layers.size(); ++i) {
-    for (auto nId : layers[i]) {
-      assert(nId < nNodes);
-      ret[nId] = i;
+std::optional<ParseError> ParseSession::State::consume(char c) {
+  ++pos.col;
+  // Edges and nodes are matched against the column to the right on the line above
+  collector.fitColumn(pos.col + 1);
+  if (c == '\n') {
+    if (auto nodeErr = collector.tryAddNode(prevEdges, pos)) {
+      return nodeErr;
     }
-  }
-  return ret;
-}
-
-std::string renderDAGWithLayers(DAG const& dag, std::vector<std::vector<size_t>> layers) {
-  // TODO: find best horisontal positions of nodes
-  auto const dimensions = nodeDimensions(dag);
-  auto coords = computeNodeCoordinates(dag, layers, dimensions);
-  auto connectivity = computeConnectivity(dag, coords, dimensions);
-  auto layerHeights = computeLayerHeights(dimensions, layers);
-  auto idToLayerMap = computeIdToLayerMap(layers, dag.nodes.size());
-  for (int i = 0; i < 5; ++i) {
-    bool moved = adjustCoordsWithValencies(coords, connectivity, layers, dimensions, layerHeights);
-    if (!moved) {
-      break;
+    if (auto dangling = prevEdges.findDanglingEdge(pos.line - 1)) {
+      return dangling;
     }
-    // Reposition edges to account for the changes in positions
-    connectivity = computeConnectivity(dag, coords, dimensions);
+    std::swap(prevEdges, currEdges);
+    currEdges.clear();
+    collector.newLine();
+    pos.col = 0;
+    ++pos.line;
+  } else if (collector.isPartOfANode(pos.col)) {
+    // Keep accumulating at least for as long as the node-line above
+    collector.addNodeChar(c);
+  } else if (auto dir = edgeChar(c)) {
+    // Continue the edge, if possible, before attaching one to a node
+    auto fromNode = prevEdges.findNRemoveEdgeToEdge(*dir, collector.getPrevNodes(), pos.col);
+    if (auto e = currEdges.updateOrError(fromNode, *dir, pos)) {
+      return e;
+    }
+    if (auto nodeErr = collector.tryAddNode(prevEdges, pos)) {
+      return nodeErr;
+    }
+  } else if (c == ' ') {
+    if (auto nodeErr = collector.tryAddNode(prevEdges, pos)) {
+      return nodeErr;
+    }
+  } else {
+    collector.addNodeChar(c);
   }
-  auto canvas = Canvas::create(coords, dimensions);
-  placeNodes(dag, coords, canvas);
-  placeEdges(coords, dimensions, idToLayerMap, layerHeights, connectivity.edges, canvas);
-  return canvas.render();
+  return {};
 }
 
-} // namespace detail
+/// Skips a run of spaces outside of nodes or takes a run of node characters at once.
+/// Either run has the same effect as consuming it char by char.
+/// Returns the length of the run, 0 if rest does not start with one.
+size_t ParseSession::State::consumeRun(string_view rest) {
+  size_t len = 0;
+  if (rest[0] == ' ' && !collector.hasPartialNode()) {
+    len = countLeadingSpaces(rest);
+  } else if (isNodeChar(rest[0])) {
+    len = countLeadingNodeChars(rest);
+    collector.addNodeChars(rest.substr(0, len));
+  }
+  pos.col += len;
+  collector.fitColumn(pos.col + 1);
+  return len;
+}
 
-std::optional<string> renderDAG(DAG dag, RenderError& err) {
-  err.code = RenderError::Code::None;
-  if (dag.nodes.empty()) {
-    return "";
-  }
-  if (auto compatErr = checkDAGCompat(dag)) {
-    err = *compatErr;
-    return {};
+std::optional<ParseError> ParseSession::State::finish() {
+  if (auto dangling = prevEdges.findDanglingEdge(pos.line - 1)) {
+    return dangling;
   }
-  if (auto crowdedErr = checkIfEdgesFitOnNodes(dag)) {
-    err = *crowdedErr;
-    return {};
+  if (auto dangling = currEdges.findDanglingEdge(pos.line)) {
+    return dangling;
   }
-  auto layers = dagLayers(dag);
-  if (auto waypointErr = insertEdgeWaypoints(dag, layers)) {
-    err = *waypointErr;
-    return {};
+  return collector.finalize();
+}
+
+std::optional<ParseError> ParseSession::State::conclude() {
+  if (!err) {
+    err = finish();
   }
+  return err;
+}
+
+void ParseSession::State::reset(bool keepText) {
+  err.reset();
+  collector.reset(keepText);
+  prevEdges.clear();
+  currEdges.clear();
+  pos = {0, 0};
+}
 
-  LOGDAGL(dag, layers, "before min crossings");
-  minimizeCrossings(layers, dag);
-  LOGDAGL(dag, layers, "after min crossings");
+ParseSession::ParseSession() : state(std::make_unique<State>(true)) {}
+ParseSession::~ParseSession() = default;
+ParseSession::ParseSession(ParseSession&&) noexcept = default;
+ParseSession& ParseSession::operator=(ParseSession&&) noexcept = default;
 
-  for (int i = 0; i < 16; ++i) {
-    if (countAllCrossings(layers, dag) == 0) {
-      break;
+bool ParseSession::feed(string_view chunk) {
+  assert(state && "feeding a finished session");
+  if (state->err) {
+    return false;
+  }
+  for (size_t i = 0; i < chunk.size();) {
+    if (size_t run = state->consumeRun(chunk.substr(i))) {
+      i += run;
+      continue;
+    }
+    if ((state->err = state->consume(chunk[i]))) {
+      return false;
     }
-    layers = insertCrossNodes(dag, layers);
-    LOGDAGL(dag, layers, "after insert X");
-    minimizeCrossings(layers, dag);
-    LOGDAGL(dag, layers, "after min crossing in the loop");
-    assert(succsSameOrderAsLayers(dag, layers));
+    ++i;
   }
+  return true;
+}
 
-  return renderDAGWithLayers(dag, layers);
+std::unique_ptr<ParseSession::State> ParseSession::finishState(ParseError& err) {
+  assert(state && "finishing a session twice");
+  auto finished = std::move(state);
+  err.code = ParseError::Code::None;
+  if (auto parseErr = finished->conclude()) {
+    err = *parseErr;
+    return nullptr;
+  }
+  return finished;
 }
 
-size_t maxLineWidth(string_view str) {
-  size_t ret = 0;
-  size_t curLine = 0;
-  for (char c : str) {
-    ++curLine;
-    if (c == '\n') {
-      ret = std::max(ret, curLine);
-      curLine = 0;
-    }
+std::optional<DAG> ParseSession::finish(ParseError& err) {
+  auto finished = finishState(err);
+  if (!finished) {
+    return std::nullopt;
   }
-  return std::max(ret, curLine);
+  return std::move(*finished).buildDAG();
 }
 
 std::optional<DAG> parseDAG(string_view str, ParseError& err) {
-  NodeCollector collector(maxLineWidth(str));
-  EdgesInFlight prevEdges;
-  EdgesInFlight currEdges;
+  ParseSession session;
+  session.feed(str);
+  return session.finish(err);
+}
+
+/// The pool that recycles the parser storage and the session parsing into it
+class ParserContext::State {
+public:
+  std::pmr::unsynchronized_pool_resource pool;
+  ParseSession session;
+  /// Whether the session state draws from the pool, it does after the first parse
+  bool pooled = false;
+};
+
+ParserContext::ParserContext() : state(std::make_unique<State>()) {}
+ParserContext::~ParserContext() = default;
+ParserContext::ParserContext(ParserContext&&) noexcept = default;
+ParserContext& ParserContext::operator=(ParserContext&&) noexcept = default;
+
+std::optional<DAG> parseDAG(string_view str, ParserContext& ctx, ParseError& err) {
   err.code = ParseError::Code::None;
-  Position pos{0, 0};
-  for (char c : str) {
-    ++pos.col;
-    if (c == '\n') {
-      if (auto nodeErr = collector.tryAddNode(prevEdges, pos)) {
-        err = *nodeErr;
-        return std::nullopt;
-      }
-      if (auto dangling = prevEdges.findDanglingEdge(pos.line - 1)) {
-        err = *dangling;
-        return std::nullopt;
-      }
-      prevEdges = std::move(currEdges);
-      currEdges = {};
-      collector.newLine();
-      pos.col = 0;
-      ++pos.line;
-    } else if (collector.isPartOfANode(pos.col)) {
-      // Keep accumulating at least for as long as the node-line above
-      collector.addNodeChar(c);
-    } else if (auto dir = edgeChar(c)) {
-      // Continue the edge, if possible, before attaching one to a node
-      auto fromNode = prevEdges.findNRemoveEdgeToEdge(*dir, collector.getPrevNodes(), pos.col);
-      if (auto e = currEdges.updateOrError(fromNode, *dir, pos)) {
-        err = *e;
-        return std::nullopt;
-      }
-      if (auto nodeErr = collector.tryAddNode(prevEdges, pos)) {
-        err = *nodeErr;
-        return std::nullopt;
-      }
-    } else if (c == ' ') {
-      if (auto nodeErr = collector.tryAddNode(prevEdges, pos)) {
-        err = *nodeErr;
-        return std::nullopt;
-      }
-    } else {
-      collector.addNodeChar(c);
-    }
+  auto& session = ctx.state->session;
+  detail::ScratchScope scope(&ctx.state->pool);
+  if (ctx.state->pooled) {
+    session.state->reset(true);
+  } else {
+    session.state = std::make_unique<ParseSession::State>(true);
+    ctx.state->pooled = true;
   }
-  if (auto dangling = prevEdges.findDanglingEdge(pos.line - 1)) {
-    err = *dangling;
+  session.feed(str);
+  if (auto parseErr = session.state->conclude()) {
+    err = *parseErr;
     return std::nullopt;
   }
-  if (auto dangling = currEdges.findDanglingEdge(pos.line)) {
-    err = *dangling;
+  return std::move(*session.state).buildDAG();
+}
+
+std::optional<SourceDAG> parseDAGInPlace(string_view str, ParseError& err) {
+  ParseSession session;
+  session.state = std::make_unique<ParseSession::State>(false);
+  session.feed(str);
+  auto finished = session.finishState(err);
+  if (!finished) {
     return std::nullopt;
   }
-  if (auto inconsistent = collector.finalize()) {
-    err = *inconsistent;
+  return std::move(*finished).buildSourceDAG(str);
+}
+
+std::optional<CompactDAG> parseCompactDAG(string_view str, ParseError& err) {
+  ParseSession session;
+  session.state = std::make_unique<ParseSession::State>(false);
+  session.feed(str);
+  auto finished = session.finishState(err);
+  if (!finished) {
     return std::nullopt;
   }
-  return std::move(collector).buildDAG();
+  return std::move(*finished).buildCompactDAG(str, err);
+}
+
+string SourceDAG::text(size_t nodeId) const {
+  auto const& label = nodes[nodeId].label;
+  string ret;
+  ret.reserve(label.height * (label.width + 1));
+  appendLabel(ret, source, lineStarts, label);
+  return ret;
+}
+
+DAG SourceDAG::toDAG() const {
+  DAG ret;
+  ret.nodes.reserve(nodes.size());
+  for (size_t i = 0; i < nodes.size(); ++i) {
+    ret.nodes.push_back({nodes[i].succs, text(i)});
+  }
+  return ret;
 }
 
 string parseErrorCodeToStr(ParseError::Code code) {
@@ -2208,6 +4585,8 @@ string parseErrorCodeToStr(ParseError::Code code) {
       return "SuspendedEdge";
     case Code::NonRectangularNode:
       return "NonRectangularNode";
+    case Code::TooLarge:
+      return "TooLarge";
     case Code::None:
       return "None";
   }
@@ -2267,18 +4646,160 @@ string toDOT(DAG const& dag) {
   return ret + "}\n";
 }
 
+GraphIndex::GraphIndex(DAG const& dag)
+  : succBegin(dag.nodes.size() + 1, 0)
+  , kinds(dag.nodes.size(), NodeKind::Regular) {
+  size_t const N = dag.nodes.size();
+  dims.reserve(N);
+  for (size_t n = 0; n < N; ++n) {
+    succBegin[n + 1] = succBegin[n] + dag.nodes[n].succs.size();
+    dims.push_back(labelDimensions(dag.nodes[n].text));
+  }
+  succIds.reserve(succBegin[N]);
+  for (auto const& node : dag.nodes) {
+    succIds.insert(succIds.end(), node.succs.begin(), node.succs.end());
+  }
+  computePreds();
+}
+
+GraphIndex GraphIndex::fromCSR(Vec<size_t> succBegin, Vec<size_t> succIds, Vec<Position> dimensions) {
+  assert(!succBegin.empty() && succBegin.back() == succIds.size());
+  assert(dimensions.size() + 1 == succBegin.size());
+  GraphIndex ret;
+  ret.kinds.assign(dimensions.size(), NodeKind::Regular);
+  ret.succBegin = std::move(succBegin);
+  ret.succIds = std::move(succIds);
+  ret.dims = std::move(dimensions);
+  ret.computePreds();
+  return ret;
+}
+
+void GraphIndex::computePreds() {
+  size_t const N = size();
+  predBegin.assign(N + 1, 0);
+  for (size_t succ : succIds) {
+    ++predBegin[succ + 1];
+  }
+  std::partial_sum(predBegin.begin(), predBegin.end(), predBegin.begin());
+  predIds.resize(predBegin[N]);
+  Vec<size_t> filled(predBegin.begin(), predBegin.end() - 1);
+  for (size_t n = 0; n < N; ++n) {
+    for (size_t succ : succs(n)) {
+      predIds[filled[succ]++] = n;
+    }
+  }
+}
+
+size_t GraphIndex::addNode(NodeKind kind, Position dimensions, std::initializer_list<size_t> succs) {
+  size_t nodeId = size();
+  succIds.insert(succIds.end(), succs);
+  succBegin.push_back(succIds.size());
+  predBegin.push_back(predIds.size());
+  dims.push_back(dimensions);
+  kinds.push_back(kind);
+  return nodeId;
+}
+
+void GraphIndex::addPred(size_t nodeId, size_t pred) {
+  assert(nodeId + 1 == size() && "Only the last node can gain predecessors");
+  predIds.push_back(pred);
+  predBegin.back() = predIds.size();
+}
+
+void GraphIndex::replaceSucc(size_t nodeId, size_t oldSucc, size_t newSucc) {
+  auto first = succIds.begin() + succBegin[nodeId];
+  auto last = succIds.begin() + succBegin[nodeId + 1];
+  auto it = std::find(first, last, oldSucc);
+  assert(it != last && "The node must be in this list");
+  *it = newSucc;
+}
+
+void GraphIndex::replacePred(size_t nodeId, size_t oldPred, size_t newPred) {
+  auto first = predIds.begin() + predBegin[nodeId];
+  auto last = predIds.begin() + predBegin[nodeId + 1];
+  auto it = std::find(first, last, oldPred);
+  assert(it != last && "The node must be in this list");
+  *it = newPred;
+}
+
+Layering::Layering(Vec2<size_t> layers) : layers(std::move(layers)) {
+  for (size_t layerI = 0; layerI < this->layers.size(); ++layerI) {
+    refreshPositions(layerI);
+  }
+}
+
+bool Layering::contains(size_t nodeId) const {
+  return nodeId < nodeLayer.size() && nodeLayer[nodeId] != absent;
+}
+
+size_t Layering::layerOf(size_t nodeId) const {
+  assert(contains(nodeId) && "The node must be in this layering");
+  return nodeLayer[nodeId];
+}
+
+size_t Layering::posOf(size_t nodeId) const {
+  assert(contains(nodeId) && "The node must be in this layering");
+  return nodePos[nodeId];
+}
+
+void Layering::appendLayer(Vec<size_t> layer) {
+  layers.emplace_back(std::move(layer));
+  refreshPositions(layers.size() - 1);
+}
+
+void Layering::appendNode(size_t layerI, size_t nodeId) {
+  assert(!contains(nodeId));
+  place(nodeId, layerI, layers[layerI].size());
+  layers[layerI].push_back(nodeId);
+}
+
+void Layering::swapNeighbors(size_t layerI, size_t pos) {
+  auto& layer = layers[layerI];
+  assert(0 < pos && pos < layer.size());
+  std::swap(layer[pos - 1], layer[pos]);
+  nodePos[layer[pos - 1]] = pos - 1;
+  nodePos[layer[pos]] = pos;
+}
+
+void Layering::reorderLayer(size_t layerI, Vec<size_t> permutation) {
+  assert(permutation.size() == layers[layerI].size());
+  layers[layerI] = std::move(permutation);
+  refreshPositions(layerI);
+}
+
+void Layering::place(size_t nodeId, size_t layerI, size_t pos) {
+  if (nodeLayer.size() <= nodeId) {
+    nodeLayer.resize(nodeId + 1, absent);
+    nodePos.resize(nodeId + 1, absent);
+  }
+  nodeLayer[nodeId] = layerI;
+  nodePos[nodeId] = pos;
+}
+
+void Layering::refreshPositions(size_t layerI) {
+  auto const& layer = layers[layerI];
+  for (size_t pos = 0; pos < layer.size(); ++pos) {
+    place(layer[pos], layerI, pos);
+  }
+}
+
 bool Canvas::inBounds(Position const& pos) const {
-  return pos.line < lines.size() && pos.col < lines[0].size();
+  return pos.line < height() && pos.col < stride;
+}
+
+void Canvas::put(Position const& pos, char c) {
+  assert(c != ' ');
+  cells[offsetOf(pos)] = c;
+  rowEnds[pos.line] = std::max(rowEnds[pos.line], pos.col + 1);
 }
 
 void Canvas::newMark(Position const& pos, char c) {
   assert(inBounds(pos));
-  assert(sketchMode || lines[pos.line][pos.col] == ' ');
-  assert(c != ' ');
-  lines[pos.line][pos.col] = c;
+  assert(sketchMode || isEmpty(pos));
+  put(pos, c);
 }
 
-void Canvas::newMark(Position const& pos, string const& str) {
+void Canvas::newMark(Position const& pos, string_view str) {
   Position offset{0, 0};
   assert(inBounds(pos));
   assert(!str.empty());
@@ -2288,40 +4809,55 @@ void Canvas::newMark(Position const& pos, string const& str) {
       ++offset.line;
       continue;
     }
-    assert(sketchMode || lines[pos.line + offset.line][pos.col + offset.col] == ' ');
-    lines[pos.line + offset.line][pos.col + offset.col] = str[i];
+    Position cur{pos.line + offset.line, pos.col + offset.col};
+    assert(inBounds(cur));
+    assert(sketchMode || isEmpty(cur));
+    put(cur, str[i]);
     ++offset.col;
   }
 }
 
 void Canvas::clearPos(Position const& pos) {
   assert(inBounds(pos));
-  assert(lines[pos.line][pos.col] != ' ');
-  lines[pos.line][pos.col] = ' ';
+  assert(!isEmpty(pos));
+  cells[offsetOf(pos)] = ' ';
+  auto& end = rowEnds[pos.line];
+  while (0 < end && cells[offsetOf({pos.line, end - 1})] == ' ') {
+    --end;
+  }
 }
 
 char Canvas::getChar(Position const& pos) const {
   assert(inBounds(pos));
-  return lines[pos.line][pos.col];
+  return cells[offsetOf(pos)];
 }
 
 size_t Canvas::width() const {
-  return lines[0].size();
+  return stride;
 }
 
 size_t Canvas::height() const {
-  return lines.size();
+  return rowEnds.size();
 }
 
 string Canvas::render() const {
   string ret;
-  ret.reserve(lines.size() * (lines[0].size() + 1));
-  for (auto const& line : lines) {
-    ret += rtrim(line) + "\n";
-  }
+  renderTo(ret);
   return ret;
 }
 
+void Canvas::renderTo(string& out) const {
+  // Every line is trimmed and followed by '\n'
+  size_t size = std::accumulate(rowEnds.begin(), rowEnds.end(), rowEnds.size());
+  out.clear();
+  out.reserve(size);
+  for (size_t line = 0; line < height(); ++line) {
+    out.append(cells.data() + offsetOf({line, 0}), rowEnds[line]);
+    out.push_back('\n');
+  }
+  assert(out.size() == size);
+}
+
 Canvas Canvas::create(Vec<Position> const& coordinates, Vec<Position> const& dimensions) {
   Position max{0, 0};
   assert(coordinates.size() == dimensions.size());
@@ -2331,21 +4867,56 @@ Canvas Canvas::create(Vec<Position> const& coordinates, Vec<Position> const& dim
   }
   // col + 1 - to accomodate potential top/bottom-right edge
   Canvas ret;
-  ret.lines = Vec<string>(max.line, string(max.col + 1, ' '));
+  ret.stride = max.col + 1;
+  ret.cells.assign(max.line * ret.stride, ' ');
+  ret.rowEnds.assign(max.line, 0);
   return ret;
 }
 
-Canvas Canvas::fromString(string const& rendered) {
+Canvas Canvas::blank(size_t width, size_t height) {
   Canvas ret;
+  ret.stride = width;
+  ret.cells.assign(height * width, ' ');
+  ret.rowEnds.assign(height, 0);
+  return ret;
+}
+
+size_t Canvas::usedWidth() const {
+  return rowEnds.empty() ? 0 : *std::max_element(rowEnds.begin(), rowEnds.end());
+}
+
+void Canvas::paste(Canvas const& piece, Position const& topLeft) {
+  assert(topLeft.line + piece.height() <= height());
+  assert(topLeft.col + piece.usedWidth() <= width());
+  for (size_t line = 0; line < piece.height(); ++line) {
+    size_t end = piece.rowEnds[line];
+    if (end == 0) {
+      continue;
+    }
+    auto from = piece.cells.begin() + static_cast<std::ptrdiff_t>(piece.offsetOf({line, 0}));
+    auto to = cells.begin() + static_cast<std::ptrdiff_t>(offsetOf({topLeft.line + line, topLeft.col}));
+    std::copy(from, from + static_cast<std::ptrdiff_t>(end), to);
+    auto& rowEnd = rowEnds[topLeft.line + line];
+    rowEnd = std::max(rowEnd, topLeft.col + end);
+  }
+}
+
+Canvas Canvas::fromString(string const& rendered) {
+  Vec<string> lines;
   string curLine;
   std::istringstream ss(rendered);
   size_t width = 0;
   while (getline(ss, curLine, '\n')) {
     width = std::max(width, curLine.size());
-    ret.lines.push_back(curLine);
+    lines.push_back(curLine);
   }
-  for (auto& line : ret.lines) {
+  Canvas ret;
+  ret.stride = width;
+  ret.cells.reserve(lines.size() * width);
+  for (auto& line : lines) {
     line.resize(width, ' ');
+    ret.cells.append(line.data(), line.size());
+    ret.rowEnds.push_back(line.find_last_not_of(' ') + 1);
   }
   return ret;
 }
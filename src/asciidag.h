@@ -1,7 +1,10 @@
 #pragma once
 
+#include <cstdint>
+#include <memory>
 #include <optional>
 #include <string>
+#include <string_view>
 #include <tuple>
 #include <vector>
 
@@ -33,7 +36,7 @@ inline bool operator==(Position const& p1, Position const& p2) {
 }
 
 struct ParseError {
-  enum class Code { None, DanglingEdge, SuspendedEdge, NonRectangularNode };
+  enum class Code { None, DanglingEdge, SuspendedEdge, NonRectangularNode, TooLarge };
 
   Code code;
   std::string message;
@@ -48,17 +51,248 @@ inline std::ostream& operator<<(std::ostream& os, ParseError::Code code) {
 }
 
 struct RenderError {
-  enum class Code { None, Overcrowded, Unsupported };
+  enum class Code { None, Overcrowded, Unsupported, Cyclic, Unroutable };
 
   Code code;
   std::string message;
   size_t nodeId;
 };
 
-std::optional<std::string> renderDAG(DAG dag, RenderError& err);
+struct RenderOptions {
+  /// How the nodes of each layer are spread horizontally
+  enum class Placement {
+    /// Every layer packed to the left
+    Packed,
+    /// The packed layers with the nodes moved towards the medians of their neighbors
+    /// (Brandes-Köpf) where that keeps the diagram as narrow and as short: straighter edges
+    MedianAligned
+  };
+
+  /// How the nodes are distributed among the layers
+  enum class LayerAssignment {
+    /// Every node right below its lowest predecessor: the fewest layers, possibly very wide ones
+    LongestPath,
+    /// At most maxLayerWidth nodes in a layer, not counting the waypoints of long edges
+    /// (Coffman-Graham): more layers, but narrower diagrams
+    WidthBounded,
+    /// The smallest total length of the edges (network simplex):
+    /// fewer waypoints, so usually smaller and faster layouts
+    MinimumSpan
+  };
+
+  /// Where the layer-by-layer ordering wants a node, relative to its neighbors in the adjacent layer
+  enum class CrossingHeuristic {
+    /// The mean of their positions
+    Barycenter,
+    /// The median of their positions (Eades-Wormald), not swayed by a single far-off neighbor
+    Median
+  };
+
+  /// How hard the ordering of the nodes within the layers works against edge crossings
+  enum class CrossingReduction {
+    /// Only the heuristic sweeps
+    Sweeps,
+    /// The sweeps, then every node moved to its best position in its layer until none moves:
+    /// slower, but fewer crossings
+    Sifting
+  };
+
+  Placement placement = Placement::Packed;
+  LayerAssignment layerAssignment = LayerAssignment::LongestPath;
+  /// Bound for LayerAssignment::WidthBounded, 0 for no bound
+  size_t maxLayerWidth = 0;
+  CrossingHeuristic crossingHeuristic = CrossingHeuristic::Barycenter;
+  /// The ordering sweeps alternate down and up the layers until a down-up round
+  /// removes no crossing or this many sweeps ran, 0 for one down-up-down round
+  size_t maxSweeps = 0;
+  CrossingReduction crossingReduction = CrossingReduction::Sweeps;
+  /// Upper bound on the threads rendering a diagram, 0 for as many as the hardware runs.
+  /// Parallel drawing is opt-in: the threads start anew for every render, which costs more
+  /// than drawing a typical diagram, and they allocate from the heap, not a RenderContext
+  size_t threads = 1;
+  /// Disconnected parts of the DAG are drawn side by side, wrapping to a new row of parts
+  /// beyond this many columns, 0 for no wrapping
+  size_t maxWidth = 0;
+};
+
+std::optional<std::string> renderDAG(DAG const& dag, RenderError& err, RenderOptions const& options = {});
+
+/// Memory reused from one render to the next.
+/// A render recycles what it frees, so the context keeps about the peak use of its biggest render.
+/// Once it has seen a DAG at least as big, rendering a connected DAG allocates nothing
+/// unless it runs several threads or fails.
+/// A context serves one render at a time.
+class RenderContext {
+public:
+  RenderContext();
+  ~RenderContext();
+  RenderContext(RenderContext&&) noexcept;
+  RenderContext& operator=(RenderContext&&) noexcept;
+
+private:
+  class State;
+  friend std::optional<std::string_view> renderDAG(
+    DAG const& dag,
+    RenderContext& ctx,
+    RenderError& err,
+    RenderOptions const& options
+  );
+
+  std::unique_ptr<State> state;
+};
+
+/// Same as renderDAG, but in the memory of ctx.
+/// The result is valid until the next render with ctx.
+std::optional<std::string_view> renderDAG(
+  DAG const& dag,
+  RenderContext& ctx,
+  RenderError& err,
+  RenderOptions const& options = {}
+);
+
+/// Immutable DAG in compressed sparse row form with 32-bit node ids.
+/// The successors, the predecessors and the labels of all nodes
+/// live in a few flat arrays instead of per-node allocations.
+class CompactDAG {
+public:
+  using Id = std::uint32_t;
+
+  /// Contiguous run of node ids
+  class Ids {
+  public:
+    Ids(Id const* first, Id const* last) : first(first), last(last) {}
+    Id const* begin() const { return first; }
+    Id const* end() const { return last; }
+    size_t size() const { return static_cast<size_t>(last - first); }
+    bool empty() const { return first == last; }
+    Id operator[](size_t i) const { return first[i]; }
+
+  private:
+    Id const* first;
+    Id const* last;
+  };
+
+  CompactDAG() = default;
+
+  /// Reports TooLarge if the nodes, the edges or the label bytes do not fit in Id
+  static std::optional<CompactDAG> fromDAG(DAG const& dag, ParseError& err);
+
+  /// succOffsets has one entry per node plus the end of succTargets,
+  /// and the same for labelOffsets and labels
+  static CompactDAG fromCSR(
+    std::vector<Id> succOffsets,
+    std::vector<Id> succTargets,
+    std::string labels,
+    std::vector<Id> labelOffsets
+  );
+
+  DAG toDAG() const;
+
+  size_t size() const { return succOffsets.size() - 1; }
+  size_t edgeCount() const { return succTargets.size(); }
+  Ids succs(Id node) const { return range(succOffsets, succTargets, node); }
+  Ids preds(Id node) const { return range(predOffsets, predSources, node); }
+  std::string_view text(Id node) const;
+
+private:
+  static Ids range(std::vector<Id> const& offsets, std::vector<Id> const& ids, Id node);
+  void computePreds();
+
+  std::vector<Id> succOffsets = {0};
+  std::vector<Id> succTargets;
+  std::vector<Id> predOffsets = {0};
+  std::vector<Id> predSources;
+  std::string labels;
+  std::vector<Id> labelOffsets = {0};
+};
+
+std::optional<std::string> renderDAG(
+  CompactDAG const& dag,
+  RenderError& err,
+  RenderOptions const& options = {}
+);
 
 std::optional<DAG> parseDAG(std::string_view str, ParseError& err);
 
+/// Rectangle of the source text holding a node label
+struct LabelRect {
+  Position topLeft; // Line and column (both from 0) of the first character
+  size_t width;
+  size_t height;
+};
+
+/// DAG whose node labels refer to the parsed text instead of owning a copy.
+/// The text must outlive it.
+struct SourceDAG {
+  struct Node {
+    std::vector<size_t> succs;
+    LabelRect label;
+  };
+
+  std::string_view source;
+  std::vector<size_t> lineStarts; // Offset of every line in the source
+  std::vector<Node> nodes;
+
+  /// Copies out the label, lines separated with '\n' as in DAG::Node::text
+  std::string text(size_t nodeId) const;
+  DAG toDAG() const;
+};
+
+/// Parser storage reused from one parse to the next.
+/// Once it has parsed a diagram at least as big, parsing allocates only for the resulting DAG.
+/// A context serves one parse at a time.
+class ParserContext {
+public:
+  ParserContext();
+  ~ParserContext();
+  ParserContext(ParserContext&&) noexcept;
+  ParserContext& operator=(ParserContext&&) noexcept;
+
+private:
+  class State;
+  friend std::optional<DAG> parseDAG(std::string_view str, ParserContext& ctx, ParseError& err);
+
+  std::unique_ptr<State> state;
+};
+
+/// Same as parseDAG, but in the memory of ctx
+std::optional<DAG> parseDAG(std::string_view str, ParserContext& ctx, ParseError& err);
+
+/// Same as parseDAG, but does not copy the node labels
+std::optional<SourceDAG> parseDAGInPlace(std::string_view str, ParseError& err);
+
+/// Same as parseDAG, builds the compact form directly.
+/// Reports TooLarge if the nodes, the edges or the label bytes do not fit in CompactDAG::Id
+std::optional<CompactDAG> parseCompactDAG(std::string_view str, ParseError& err);
+
+/// Incremental parser for input that arrives in chunks, e.g., from a pipe.
+/// Chunks may split lines at any byte.
+/// Memory grows with the line width and the number of nodes, not with the input size.
+class ParseSession {
+public:
+  ParseSession();
+  ~ParseSession();
+  ParseSession(ParseSession&&) noexcept;
+  ParseSession& operator=(ParseSession&&) noexcept;
+
+  /// Returns false once the input is known to be malformed,
+  /// the error is then reported by finish()
+  bool feed(std::string_view chunk);
+
+  /// Ends the input; the session cannot be used afterwards
+  std::optional<DAG> finish(ParseError& err);
+
+private:
+  class State;
+  friend std::optional<SourceDAG> parseDAGInPlace(std::string_view str, ParseError& err);
+  friend std::optional<CompactDAG> parseCompactDAG(std::string_view str, ParseError& err);
+  friend std::optional<DAG> parseDAG(std::string_view str, ParserContext& ctx, ParseError& err);
+
+  std::unique_ptr<State> finishState(ParseError& err);
+
+  std::unique_ptr<State> state;
+};
+
 std::string toDOT(DAG const& dag);
 
 } // namespace asciidag
@@ -2,17 +2,66 @@
 
 #include "asciidag.h"
 
+#include <algorithm>
+#include <exception>
+#include <initializer_list>
+#include <limits>
+#include <memory_resource>
+#include <mutex>
+#include <optional>
 #include <string>
+#include <system_error>
+#include <thread>
 #include <vector>
 
 namespace asciidag::detail {
 
+/// Names the first count that does not fit in CompactDAG::Id, if any
+std::optional<std::string> compactDAGOverflow(size_t nNodes, size_t nEdges, size_t labelBytes);
+
+/// The arena of the RenderContext rendering on this thread, or the heap
+std::pmr::memory_resource* scratchResource();
+
+/// Allocates from the scratchResource() current at construction.
+/// Containers keep their resource, so they can be freed from any thread.
 template <typename T>
-using Vec = std::vector<T>;
+class ScratchAllocator {
+public:
+  using value_type = T;
+
+  ScratchAllocator() noexcept : resource(scratchResource()) {}
+  template <typename U>
+  ScratchAllocator(ScratchAllocator<U> const& other) noexcept : resource(other.resource) {}
+
+  T* allocate(size_t n) {
+    return static_cast<T*>(resource->allocate(n * sizeof(T), alignof(T)));
+  }
+  void deallocate(T* p, size_t n) {
+    resource->deallocate(p, n * sizeof(T), alignof(T));
+  }
+  /// Copies belong to the arena of the copying thread
+  ScratchAllocator select_on_container_copy_construction() const { return {}; }
+
+  template <typename U>
+  bool operator==(ScratchAllocator<U> const& other) const { return resource == other.resource; }
+  template <typename U>
+  bool operator!=(ScratchAllocator<U> const& other) const { return resource != other.resource; }
+
+private:
+  template <typename U>
+  friend class ScratchAllocator;
+
+  std::pmr::memory_resource* resource;
+};
+
+template <typename T>
+using Vec = std::vector<T, ScratchAllocator<T>>;
 
 template <typename T>
 using Vec2 = Vec<Vec<T>>;
 
+using ScratchString = std::basic_string<char, std::char_traits<char>, ScratchAllocator<char>>;
+
 using std::string;
 using std::string_view;
 
@@ -22,34 +71,232 @@ enum class Direction : int { Left = 1, Straight = 2, Right = 3 };
 
 class Canvas {
 public:
-  static Canvas
-  create(std::vector<Position> const& coordinates, std::vector<Position> const& dimensions);
+  static Canvas create(Vec<Position> const& coordinates, Vec<Position> const& dimensions);
   static Canvas fromString(std::string const& str);
+  static Canvas blank(size_t width, size_t height);
+
+  /// Copies the marks of piece so that its top-left corner lands on topLeft
+  void paste(Canvas const& piece, Position const& topLeft);
 
   void newMark(Position const& pos, char c);
-  void newMark(Position const& pos, std::string const& str);
+  void newMark(Position const& pos, std::string_view str);
   void clearPos(Position const& pos);
   char getChar(Position const& pos) const;
   bool isEmpty(Position const& pos) const { return getChar(pos) == ' '; }
   size_t width() const;
   size_t height() const;
+  /// One past the right-most mark
+  size_t usedWidth() const;
   bool inBounds(Position const& pos) const;
 
   std::string render() const;
+  /// Same as render(), reusing the capacity of out
+  void renderTo(std::string& out) const;
 
 private:
   Canvas(){};
-  std::vector<std::string> lines;
+  size_t offsetOf(Position const& pos) const { return pos.line * stride + pos.col; }
+  void put(Position const& pos, char c);
+
+  /// Row-major characters, stride per line
+  ScratchString cells;
+  size_t stride = 0;
+  /// One past the right-most non-space column of every line
+  Vec<size_t> rowEnds;
 };
 
-/// Returns false if it failed to draw the edge
+/// Nodes distributed among layers, top to bottom.
+/// Keeps the layer and the in-layer position of every node in sync with the layers
+/// so that both can be looked up in constant time.
+class Layering {
+public:
+  Layering() = default;
+  explicit Layering(Vec2<size_t> layers);
+
+  size_t size() const { return layers.size(); }
+  Vec<size_t> const& operator[](size_t layerI) const { return layers[layerI]; }
+  auto begin() const { return layers.begin(); }
+  auto end() const { return layers.end(); }
+
+  bool contains(size_t nodeId) const;
+  size_t layerOf(size_t nodeId) const;
+  size_t posOf(size_t nodeId) const;
+
+  void appendLayer(Vec<size_t> layer);
+  void appendNode(size_t layerI, size_t nodeId);
+  /// Swaps the nodes at positions pos - 1 and pos
+  void swapNeighbors(size_t layerI, size_t pos);
+  /// Replaces the layer with a permutation of itself
+  void reorderLayer(size_t layerI, Vec<size_t> permutation);
+
+  template <typename Compare>
+  void stableSortLayer(size_t layerI, Compare const& comp) {
+    // Ties keep their current positions; std::stable_sort would take a heap buffer
+    std::sort(layers[layerI].begin(), layers[layerI].end(), [this, &comp](size_t a, size_t b) {
+      if (comp(a, b) || comp(b, a)) {
+        return comp(a, b);
+      }
+      return nodePos[a] < nodePos[b];
+    });
+    refreshPositions(layerI);
+  }
+
+private:
+  static constexpr size_t absent = std::numeric_limits<size_t>::max();
+
+  void place(size_t nodeId, size_t layerI, size_t pos);
+  void refreshPositions(size_t layerI);
+
+  Vec2<size_t> layers;
+  Vec<size_t> nodeLayer;
+  Vec<size_t> nodePos;
+};
+
+/// Role of a node in the rendered layout
+enum class NodeKind { Regular, Waypoint, Cross };
+
+/// Node ids stored contiguously in a GraphIndex, invalidated by adding nodes to it
+class NodeIds {
+public:
+  NodeIds(size_t const* first, size_t const* last) : first(first), last(last) {}
+
+  size_t const* begin() const { return first; }
+  size_t const* end() const { return last; }
+  size_t size() const { return static_cast<size_t>(last - first); }
+  bool empty() const { return first == last; }
+  size_t const& operator[](size_t i) const { return first[i]; }
+
+private:
+  size_t const* first;
+  size_t const* last;
+};
+
+/// The graph the render phases work on: the nodes of the DAG,
+/// followed by the waypoint and the crossing nodes inserted while laying it out.
+/// An inserted node exists only here, as its kind and one or two successor and predecessor
+/// slots, so the segment of a long edge in every layer it spans costs no DAG node.
+/// The successors and the predecessors of all the nodes are kept in flat arrays.
+class GraphIndex {
+public:
+  GraphIndex() = default;
+  /// All the nodes of dag are Regular, whatever their labels
+  explicit GraphIndex(DAG const& dag);
+  /// succBegin has one entry per node plus the end of succIds, all the nodes are Regular
+  static GraphIndex fromCSR(Vec<size_t> succBegin, Vec<size_t> succIds, Vec<Position> dimensions);
+
+  size_t size() const { return kinds.size(); }
+  NodeIds succs(size_t nodeId) const {
+    return {succIds.data() + succBegin[nodeId], succIds.data() + succBegin[nodeId + 1]};
+  }
+  NodeIds preds(size_t nodeId) const {
+    return {predIds.data() + predBegin[nodeId], predIds.data() + predBegin[nodeId + 1]};
+  }
+  Vec<Position> const& dimensions() const { return dims; }
+  NodeKind kind(size_t nodeId) const { return kinds[nodeId]; }
+
+  /// Appends a node with the given successors and no predecessors yet, returns its id
+  size_t addNode(NodeKind kind, Position dimensions, std::initializer_list<size_t> succs);
+  /// Only the node added last can gain predecessors
+  void addPred(size_t nodeId, size_t pred);
+  void replaceSucc(size_t nodeId, size_t oldSucc, size_t newSucc);
+  void replacePred(size_t nodeId, size_t oldPred, size_t newPred);
+
+  /// Orders the successors of every node by comp
+  template <typename Compare>
+  void sortSuccs(Compare const& comp) {
+    for (size_t n = 0; n < size(); ++n) {
+      std::sort(succIds.begin() + succBegin[n], succIds.begin() + succBegin[n + 1], comp);
+    }
+  }
+
+private:
+  void computePreds();
+
+  /// The successors of node n are at [succBegin[n], succBegin[n + 1]) of succIds
+  Vec<size_t> succIds;
+  Vec<size_t> succBegin;
+  /// Same for the predecessors
+  Vec<size_t> predIds;
+  Vec<size_t> predBegin;
+  Vec<Position> dims;
+  Vec<NodeKind> kinds;
+};
+
+/// Runs work on the calling thread and on up to nThreads - 1 more.
+/// Every call of work must keep taking tasks from a shared queue until it is empty,
+/// so the calling thread does everything left when no other thread could be started.
+/// The first exception thrown by work is rethrown once all the threads are joined.
+template <typename Work>
+void runOnThreads(size_t nThreads, Work const& work) {
+  std::mutex errMutex;
+  std::exception_ptr firstErr;
+  auto guardedWork = [&work, &errMutex, &firstErr]() {
+    try {
+      work();
+    } catch (...) {
+      std::lock_guard<std::mutex> lock(errMutex);
+      if (!firstErr) {
+        firstErr = std::current_exception();
+      }
+    }
+  };
+  Vec<std::thread> workers;
+  workers.reserve(nThreads - 1);
+  struct JoinAll {
+    Vec<std::thread>& threads;
+    ~JoinAll() {
+      for (auto& thread : threads) {
+        thread.join();
+      }
+    }
+  };
+  {
+    JoinAll const joinAll{workers};
+    try {
+      for (size_t i = 1; i < nThreads; ++i) {
+        workers.emplace_back(guardedWork);
+      }
+    } catch (std::system_error const&) {
+      // Go on with the threads that did start
+    }
+    guardedWork();
+  }
+  if (firstErr) {
+    std::rethrow_exception(firstErr);
+  }
+}
+
+/// Returns false, leaving the canvas intact, if there is no free path for the edge
 bool drawEdge(Position cur, Direction curDir, Position to, Direction finishDir, Canvas& canvas);
 
-string renderDAGWithLayers(DAG const& dag, Vec2<size_t> layers);
+/// Assigns the nodes to layers and splits the edges spanning several layers with waypoints
+std::optional<RenderError>
+layerDAG(GraphIndex& index, Layering& layers, RenderOptions const& options = {});
 
-void minimizeCrossings(Vec2<size_t>& layers, DAG& dag);
+/// Returns nullopt and sets err if some edge cannot be routed
+std::optional<string> renderDAGWithLayers(
+  DAG const& dag,
+  GraphIndex const& index,
+  Layering const& layers,
+  RenderError& err,
+  RenderOptions const& options = {}
+);
 
-Vec2<size_t> insertCrossNodes(DAG& dag, Vec2<size_t> const& layers);
+/// Same as above, but omits the edges it cannot route
+string renderDAGWithLayers(
+  DAG const& dag,
+  GraphIndex const& index,
+  Layering const& layers,
+  RenderOptions const& options = {}
+);
+
+/// Same as renderDAG, but lays out disconnected parts together, sharing the layers
+std::optional<string>
+renderUnsplitDAG(DAG const& dag, RenderError& err, RenderOptions const& options = {});
+
+void minimizeCrossings(Layering& layers, GraphIndex& index, RenderOptions const& options = {});
+
+Layering insertCrossNodes(GraphIndex& index, Layering const& layers);
 
 struct CrossingPair {
   size_t fromLeft;
@@ -59,8 +306,17 @@ struct CrossingPair {
 };
 
 Vec<CrossingPair>
-findNonConflictingCrossings(DAG const& dag, Vec<size_t> const& lAbove, Vec<size_t> const& lBelow);
+findNonConflictingCrossings(GraphIndex const& index, Vec<size_t> const& lAbove, Vec<size_t> const& lBelow);
+
+size_t countCrossings(GraphIndex const& index, Vec<size_t> const& lAbove, Vec<size_t> const& lBelow);
+
+/// Counts the crossings between the layers upperLayerI and upperLayerI + 1
+size_t countCrossings(GraphIndex const& index, Layering const& layers, size_t upperLayerI);
+
+/// Length of the prefix of str made of spaces
+size_t countLeadingSpaces(string_view str);
 
-size_t countCrossings(DAG const& dag, Vec<size_t> const& lAbove, Vec<size_t> const& lBelow);
+/// Length of the prefix of str with no spaces, line breaks or edge characters
+size_t countLeadingNodeChars(string_view str);
 
 } // namespace asciidag::detail
@@ -0,0 +1,125 @@
+#include "asciidag.h"
+#include "asciidagImpl.h"
+
+#include <gtest/gtest.h>
+#include <sstream>
+
+using namespace asciidag;
+
+namespace {
+
+std::string toString(DAG const& dag) {
+  std::stringstream ss;
+  ss << dag;
+  return ss.str();
+}
+
+std::vector<CompactDAG::Id> toVec(CompactDAG::Ids ids) {
+  return {ids.begin(), ids.end()};
+}
+
+using Ids = std::vector<CompactDAG::Id>;
+
+CompactDAG compactOf(DAG const& dag) {
+  ParseError err;
+  auto ret = CompactDAG::fromDAG(dag, err);
+  EXPECT_EQ(err.code, ParseError::Code::None);
+  return ret.value_or(CompactDAG{});
+}
+
+} // namespace
+
+TEST(compactDAG, roundTrip) {
+  DAG dag;
+  dag.nodes = {{{1, 2}, "a"}, {{3}, "bb\nbb"}, {{3}, "c"}, {{}, "d"}};
+  auto compact = compactOf(dag);
+  ASSERT_EQ(compact.size(), 4U);
+  EXPECT_EQ(compact.edgeCount(), 4U);
+  EXPECT_EQ(compact.text(1), "bb\nbb");
+  EXPECT_EQ(toVec(compact.succs(0)), (Ids{1, 2}));
+  EXPECT_TRUE(compact.succs(3).empty());
+  EXPECT_EQ(toString(compact.toDAG()), toString(dag));
+}
+
+TEST(compactDAG, predecessors) {
+  DAG dag;
+  dag.nodes = {{{2, 1}, "a"}, {{2}, "b"}, {{}, "c"}, {{2, 0}, "d"}};
+  auto compact = compactOf(dag);
+  EXPECT_EQ(toVec(compact.preds(0)), (Ids{3}));
+  EXPECT_TRUE(compact.preds(3).empty());
+  EXPECT_EQ(toVec(compact.preds(1)), (Ids{0}));
+  EXPECT_EQ(toVec(compact.preds(2)), (Ids{0, 1, 3}));
+}
+
+TEST(compactDAG, empty) {
+  auto compact = compactOf(DAG{});
+  EXPECT_EQ(compact.size(), 0U);
+  EXPECT_EQ(compact.edgeCount(), 0U);
+  EXPECT_TRUE(compact.toDAG().nodes.empty());
+}
+
+TEST(compactDAG, parsedLikeParseDAG) {
+  std::string str = R"(
+    A   BB
+     \  BB
+      \ /
+       X
+      / \
+     C   D
+)";
+  ParseError err;
+  auto dag = parseDAG(str, err);
+  ASSERT_TRUE(dag.has_value());
+  auto compact = parseCompactDAG(str, err);
+  ASSERT_TRUE(compact.has_value());
+  EXPECT_EQ(err.code, ParseError::Code::None);
+  EXPECT_EQ(toString(compact->toDAG()), toString(*dag));
+  EXPECT_EQ(compact->text(1), "BB\nBB");
+}
+
+TEST(compactDAG, parseErrorReported) {
+  std::string str = R"(
+  a
+  |
+)";
+  ParseError err;
+  EXPECT_FALSE(parseCompactDAG(str, err).has_value());
+  EXPECT_EQ(err.code, ParseError::Code::DanglingEdge);
+}
+
+TEST(compactDAG, overflowNamesTheCount) {
+  size_t const limit = std::numeric_limits<CompactDAG::Id>::max();
+  EXPECT_FALSE(detail::compactDAGOverflow(limit, limit, limit).has_value());
+  auto const tooMany = std::to_string(limit + 1);
+  EXPECT_EQ(
+    detail::compactDAGOverflow(limit + 1, 0, 0),
+    tooMany + " nodes do not fit in 32-bit ids"
+  );
+  EXPECT_EQ(
+    detail::compactDAGOverflow(0, limit + 1, 0),
+    tooMany + " edges do not fit in 32-bit ids"
+  );
+  EXPECT_EQ(
+    detail::compactDAGOverflow(0, 0, limit + 1),
+    tooMany + " label bytes do not fit in 32-bit ids"
+  );
+}
+
+TEST(compactDAG, rendersLikeDAG) {
+  std::string str = R"(
+  a
+ / \
+b   c
+ \ /
+  d
+)";
+  ParseError parseErr;
+  auto dag = parseDAG(str, parseErr);
+  ASSERT_TRUE(dag.has_value());
+  RenderError err;
+  auto expected = renderDAG(*dag, err);
+  auto rendered = renderDAG(compactOf(*dag), err);
+  ASSERT_TRUE(rendered.has_value());
+  EXPECT_EQ(err.code, RenderError::Code::None);
+  EXPECT_EQ(*rendered, *expected);
+}
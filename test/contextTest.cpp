@@ -0,0 +1,181 @@
+#include "asciidag.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <gtest/gtest.h>
+#include <new>
+#include <sstream>
+
+using namespace asciidag;
+
+namespace {
+
+std::atomic<size_t> heapAllocations{0};
+
+void* countedAlloc(size_t size, size_t alignment) {
+  ++heapAllocations;
+  size = size == 0 ? 1 : size;
+  void* p = alignment <= alignof(std::max_align_t)
+            ? std::malloc(size)
+            : std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+  if (p == nullptr) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+} // namespace
+
+void* operator new(size_t size) {
+  return countedAlloc(size, alignof(std::max_align_t));
+}
+void* operator new(size_t size, std::align_val_t alignment) {
+  return countedAlloc(size, static_cast<size_t>(alignment));
+}
+void operator delete(void* p) noexcept {
+  std::free(p);
+}
+void operator delete(void* p, size_t) noexcept {
+  std::free(p);
+}
+void operator delete(void* p, std::align_val_t) noexcept {
+  std::free(p);
+}
+void operator delete(void* p, size_t, std::align_val_t) noexcept {
+  std::free(p);
+}
+
+namespace {
+
+/// Connected DAGs, the last two need waypoints and a crossing node respectively
+std::vector<DAG> sampleDAGs() {
+  std::vector<DAG> ret(5);
+  ret[0].nodes = {{{1, 2}, "a"}, {{3}, "b"}, {{3}, "c"}, {{}, "d"}};
+  ret[1].nodes = {{{1, 2, 3}, "root"}, {{4}, "x"}, {{4, 5}, "y"}, {{5}, "z"}, {{}, "u"}, {{}, "v"}};
+  ret[2].nodes = {{{1}, "a\nb"}, {{}, "c"}};
+  ret[3].nodes = {{{1, 3}, "a"}, {{2}, "b"}, {{3}, "c"}, {{}, "d"}};
+  ret[4].nodes = {{{1, 2}, "r"}, {{3, 4}, "a"}, {{3, 4}, "b"}, {{}, "c"}, {{}, "d"}};
+  return ret;
+}
+
+RenderOptions singleThreaded() {
+  RenderOptions ret;
+  ret.threads = 1;
+  return ret;
+}
+
+} // namespace
+
+TEST(renderContext, sameAsRenderDAG) {
+  RenderContext ctx;
+  RenderError err;
+  for (auto const& dag : sampleDAGs()) {
+    auto expected = renderDAG(dag, err);
+    ASSERT_TRUE(expected);
+    auto rendered = renderDAG(dag, ctx, err);
+    ASSERT_TRUE(rendered);
+    EXPECT_EQ(*rendered, *expected);
+  }
+}
+
+TEST(renderContext, errorsAreReported) {
+  RenderContext ctx;
+  RenderError err;
+  DAG cyclic;
+  cyclic.nodes = {{{1}, "a"}, {{0}, "b"}};
+  EXPECT_FALSE(renderDAG(cyclic, ctx, err));
+  EXPECT_EQ(err.code, RenderError::Code::Cyclic);
+  DAG dag;
+  dag.nodes = {{{1}, "a"}, {{}, "b"}};
+  auto rendered = renderDAG(dag, ctx, err);
+  ASSERT_TRUE(rendered);
+  EXPECT_EQ(err.code, RenderError::Code::None);
+  EXPECT_EQ(*rendered, *renderDAG(dag, err));
+}
+
+TEST(renderContext, noAllocationsAfterWarmUp) {
+  auto const dags = sampleDAGs();
+  auto const options = singleThreaded();
+  RenderContext ctx;
+  RenderError err;
+  for (auto const& dag : dags) {
+    ASSERT_TRUE(renderDAG(dag, ctx, err, options));
+  }
+  size_t before = heapAllocations;
+  for (int round = 0; round < 3; ++round) {
+    for (auto const& dag : dags) {
+      ASSERT_TRUE(renderDAG(dag, ctx, err, options));
+    }
+  }
+  EXPECT_EQ(heapAllocations - before, 0U);
+}
+
+namespace {
+
+/// A tall diagram, every repetition adds two nodes and four lines
+std::string tallDiagram(size_t repetitions) {
+  std::string ret = "a\n|\n";
+  for (size_t i = 0; i < repetitions; ++i) {
+    ret += "b\n|\\\nc d\n|/\n";
+  }
+  return ret + "e\n";
+}
+
+size_t parseAllocations(ParserContext& ctx, std::string const& diagram) {
+  ParseError err;
+  size_t before = heapAllocations;
+  auto dag = parseDAG(diagram, ctx, err);
+  size_t after = heapAllocations;
+  EXPECT_TRUE(dag) << err;
+  return after - before;
+}
+
+size_t copyAllocations(DAG const& dag) {
+  size_t before = heapAllocations;
+  DAG copy = dag;
+  return heapAllocations - before;
+}
+
+} // namespace
+
+TEST(parserContext, sameAsParseDAG) {
+  ParserContext ctx;
+  ParseError err;
+  for (std::string diagram : {"a\n|\n|\nb\n", "a b\n|/\nX\n|\\\nc d\n", "aa\naa\n|\nb\n"}) {
+    auto expected = parseDAG(diagram, err);
+    ASSERT_TRUE(expected) << err;
+    auto parsed = parseDAG(diagram, ctx, err);
+    ASSERT_TRUE(parsed) << err;
+    std::stringstream expectedStr;
+    std::stringstream parsedStr;
+    expectedStr << *expected;
+    parsedStr << *parsed;
+    EXPECT_EQ(parsedStr.str(), expectedStr.str());
+  }
+}
+
+TEST(parserContext, errorsAreReported) {
+  ParserContext ctx;
+  ParseError err;
+  EXPECT_FALSE(parseDAG("a\n|\n", ctx, err));
+  EXPECT_EQ(err.code, ParseError::Code::DanglingEdge);
+  auto dag = parseDAG("a\n|\nb\n", ctx, err);
+  ASSERT_TRUE(dag);
+  EXPECT_EQ(err.code, ParseError::Code::None);
+  EXPECT_EQ(dag->nodes.size(), 2U);
+}
+
+TEST(parserContext, allocatesOnlyTheResult) {
+  ParserContext ctx;
+  ParseError err;
+  auto const diagram = tallDiagram(50);
+  parseAllocations(ctx, diagram);
+  auto dag = parseDAG(diagram, err);
+  ASSERT_TRUE(dag);
+  EXPECT_EQ(parseAllocations(ctx, diagram), copyAllocations(*dag));
+  // Smaller inputs fit the storage of the bigger one
+  auto const shorter = tallDiagram(10);
+  auto smallDag = parseDAG(shorter, err);
+  ASSERT_TRUE(smallDag);
+  EXPECT_EQ(parseAllocations(ctx, shorter), copyAllocations(*smallDag));
+}
@@ -2,6 +2,7 @@
 #include "testUtils.h"
 
 #include <gtest/gtest.h>
+#include <random>
 
 using namespace asciidag;
 using namespace asciidag::tests;
@@ -229,8 +230,8 @@ TEST(crossingDiscoveryTest, singleEdge) {
 )";
   auto [dag, layers] = parseWithLayers(str);
   ASSERT_EQ(layers.size(), 2U);
-  EXPECT_EQ(countCrossings(dag, layers[0], layers[1]), 0U);
-  auto crossings = findNonConflictingCrossings(dag, layers[0], layers[1]);
+  EXPECT_EQ(countCrossings(GraphIndex(dag), layers[0], layers[1]), 0U);
+  auto crossings = findNonConflictingCrossings(GraphIndex(dag), layers[0], layers[1]);
   EXPECT_EQ(crossings.size(), 0U);
 }
 
@@ -244,8 +245,8 @@ TEST(crossingDiscoveryTest, singleCrossing) {
 )";
   auto [dag, layers] = parseWithLayers(str);
   ASSERT_EQ(layers.size(), 2U);
-  EXPECT_EQ(countCrossings(dag, layers[0], layers[1]), 1U);
-  auto crossings = findNonConflictingCrossings(dag, layers[0], layers[1]);
+  EXPECT_EQ(countCrossings(GraphIndex(dag), layers[0], layers[1]), 1U);
+  auto crossings = findNonConflictingCrossings(GraphIndex(dag), layers[0], layers[1]);
   ASSERT_EQ(crossings.size(), 1U);
   ASSERT_EQ(crossings[0].fromLeft, 0U);
   ASSERT_EQ(crossings[0].fromRight, 1U);
@@ -261,8 +262,8 @@ TEST(crossingDiscoveryTest, twoIndependentEdges) {
 )";
   auto [dag, layers] = parseWithLayers(str);
   ASSERT_EQ(layers.size(), 2U);
-  EXPECT_EQ(countCrossings(dag, layers[0], layers[1]), 0U);
-  auto crossings = findNonConflictingCrossings(dag, layers[0], layers[1]);
+  EXPECT_EQ(countCrossings(GraphIndex(dag), layers[0], layers[1]), 0U);
+  auto crossings = findNonConflictingCrossings(GraphIndex(dag), layers[0], layers[1]);
   EXPECT_EQ(crossings.size(), 0U);
 }
 
@@ -276,8 +277,8 @@ TEST(crossingDiscoveryTest, crossingAndIndependentEdge) {
 )";
   auto [dag, layers] = parseWithLayers(str);
   ASSERT_EQ(layers.size(), 2U);
-  EXPECT_EQ(countCrossings(dag, layers[0], layers[1]), 1U);
-  auto crossings = findNonConflictingCrossings(dag, layers[0], layers[1]);
+  EXPECT_EQ(countCrossings(GraphIndex(dag), layers[0], layers[1]), 1U);
+  auto crossings = findNonConflictingCrossings(GraphIndex(dag), layers[0], layers[1]);
   ASSERT_EQ(crossings.size(), 1U);
   ASSERT_EQ(crossings[0].fromLeft, 0U);
   ASSERT_EQ(crossings[0].fromRight, 1U);
@@ -297,8 +298,8 @@ TEST(crossingDiscoveryTest, findsTopmostCrossingFirstFail) {
 )";
   auto [dag, layers] = parseWithLayers(str);
   ASSERT_EQ(layers.size(), 2U);
-  EXPECT_EQ(countCrossings(dag, layers[0], layers[1]), 2U);
-  auto crossings = findNonConflictingCrossings(dag, layers[0], layers[1]);
+  EXPECT_EQ(countCrossings(GraphIndex(dag), layers[0], layers[1]), 2U);
+  auto crossings = findNonConflictingCrossings(GraphIndex(dag), layers[0], layers[1]);
   ASSERT_EQ(crossings.size(), 1U);
   ASSERT_EQ(crossings[0].fromLeft, 0U);
   ASSERT_EQ(crossings[0].fromRight, 2U);
@@ -325,11 +326,37 @@ TEST(crossingDiscoveryTest, twoCrossingsSameEdgeDifferentSides) {
 )";
   auto [dag, layers] = parseWithLayers(str);
   ASSERT_EQ(layers.size(), 2U);
-  EXPECT_EQ(countCrossings(dag, layers[0], layers[1]), 3U);
-  auto crossings = findNonConflictingCrossings(dag, layers[0], layers[1]);
+  EXPECT_EQ(countCrossings(GraphIndex(dag), layers[0], layers[1]), 3U);
+  auto crossings = findNonConflictingCrossings(GraphIndex(dag), layers[0], layers[1]);
   ASSERT_EQ(crossings.size(), 1U);
   ASSERT_EQ(crossings[0].fromLeft, 0U);
   ASSERT_EQ(crossings[0].fromRight, 1U);
   ASSERT_EQ(crossings[0].toLeft, 4U);
   ASSERT_EQ(crossings[0].toRight, 5U);
 }
+
+TEST(crossingDiscoveryTest, countMatchesPairwiseComparison) {
+  std::mt19937_64 gen(0);
+  for (size_t iteration = 0; iteration < 200; ++iteration) {
+    size_t const nAbove = 1 + gen() % 12;
+    size_t const nBelow = 1 + gen() % 12;
+    DAG dag;
+    dag.nodes.resize(nAbove + nBelow, {{}, "n"});
+    Vec<size_t> lAbove;
+    Vec<size_t> lBelow;
+    for (size_t i = 0; i < nAbove; ++i) {
+      lAbove.push_back(i);
+      for (size_t j = 0; j < nBelow; ++j) {
+        if (gen() % 3 == 0) {
+          dag.nodes[i].succs.push_back(nAbove + j);
+        }
+      }
+    }
+    for (size_t j = 0; j < nBelow; ++j) {
+      lBelow.push_back(nAbove + j);
+    }
+    std::shuffle(lAbove.begin(), lAbove.end(), gen);
+    std::shuffle(lBelow.begin(), lBelow.end(), gen);
+    EXPECT_EQ(countCrossings(GraphIndex(dag), lAbove, lBelow), countCrossingsPairwise(dag, lAbove, lBelow));
+  }
+}
@@ -3,9 +3,30 @@
 
 #include <gtest/gtest.h>
 
+#include <random>
+
 using namespace asciidag;
 using namespace asciidag::tests;
 
+namespace {
+
+/// Same as parseAndRender, but keeps the disconnected parts in the same layout,
+/// so that they take part in each other's crossing minimization
+std::string renderUnsplit(std::string_view str) {
+  ParseError parseErr;
+  auto dag = parseDAG(str, parseErr);
+  EXPECT_TRUE(dag) << parseErr;
+  if (!dag) {
+    return "";
+  }
+  RenderError renderErr;
+  auto result = renderUnsplitDAG(*dag, renderErr);
+  EXPECT_TRUE(result) << renderErr.message;
+  return "\n" + result.value_or("");
+}
+
+} // namespace
+
 TEST(crossingMinimizationTest, preserveSingleEdge) {
   EXPECT_EQ(parseAndRender(R"(
 0
@@ -196,7 +217,7 @@ R"(
 
 TEST(crossingMinimizationTest, untangleTwoPredsCrossedOne) {
   // This untangling requries moving the nodes in the upper layer
-  EXPECT_EQ(parseAndRender(R"(
+  EXPECT_EQ(renderUnsplit(R"(
     0 1 2
     |/ /
     X /
@@ -214,7 +235,7 @@ R"(
 
 TEST(crossingMinimizationTest, untangleTwoPredsCrossedTwo) {
   // This untangling requries moving the nodes in the upper layer
-  EXPECT_EQ(parseAndRender(R"(
+  EXPECT_EQ(renderUnsplit(R"(
     0 1 2
     |/ /
     X /
@@ -233,7 +254,7 @@ R"(
 }
 
 TEST(crossingMinimizationTest, untangleTwoSuccsCrossedOne) {
-  EXPECT_EQ(parseAndRender(R"(
+  EXPECT_EQ(renderUnsplit(R"(
     0 1
     |/|
     X |
@@ -250,7 +271,7 @@ R"(
 }
 
 TEST(crossingMinimizationTest, untangleTwoSuccsCrossedTwo) {
-  EXPECT_EQ(parseAndRender(R"(
+  EXPECT_EQ(renderUnsplit(R"(
     0 1
     |/|
     X /
@@ -269,7 +290,7 @@ R"(
 }
 
 TEST(crossingMinimizationTest, untangleHammockWithIntruder) {
-  EXPECT_EQ(parseAndRender(R"(
+  EXPECT_EQ(renderUnsplit(R"(
 1   2
  \ / \
   X   \
@@ -374,7 +395,7 @@ TEST(crossingMinimizationTest, untangleCentripetalSymmetricalCrossingFail) {
   // aim at the center (position 1), so they stay where they are
   // Also, moving nodes only on one layer does not reduce number of crossings
   // you must move nodes on both layers simultaneously
-  EXPECT_EQ(parseAndRender(R"(
+  EXPECT_EQ(renderUnsplit(R"(
  0   1   2
   \ / \ /
    X   X
@@ -403,7 +424,7 @@ TEST(crossingMinimizationTest, untangleUnrelatedGraphInTheMiddleFail) {
   // Here the 1-4 graph is best taken on the side to avoid extra edge crossings.
   // However, moving only 1 or only 4 to either side brings no immediate improvement,
   // so it stays in place.
-  EXPECT_EQ(parseAndRender(R"(
+  EXPECT_EQ(renderUnsplit(R"(
  0 1 2
  |\|/|
  | X |
@@ -442,7 +463,7 @@ TEST(crossingMinimizationTest, deconstructedRenderingNoMinimizationParallel) {
 2 3
 )";
   auto [dag, layers] = parseWithLayers(str);
-  EXPECT_EQ(str, '\n' + renderDAGWithLayers(dag, layers));
+  EXPECT_EQ(str, '\n' + renderDAGWithLayers(dag, GraphIndex(dag), layers));
 }
 
 TEST(crossingMinimizationTest, deconstructedRenderingNoUncrossing) {
@@ -456,15 +477,21 @@ TEST(crossingMinimizationTest, deconstructedRenderingNoUncrossing) {
 2 3
 )";
   auto [dag, layers] = parseWithLayers(str);
+  // The edge 1->2 cannot be routed without crossing 0->3,
+  // so it is left out entirely instead of being drawn half-way
   EXPECT_EQ(R"(
 0     1
  \
   \
    \
     \
- /   \
+     \
 2     3
-)", '\n' + renderDAGWithLayers(dag, layers));
+)", '\n' + renderDAGWithLayers(dag, GraphIndex(dag), layers));
+  RenderError err;
+  EXPECT_FALSE(renderDAGWithLayers(dag, GraphIndex(dag), layers, err));
+  EXPECT_EQ(err.code, RenderError::Code::Unroutable);
+  EXPECT_EQ(err.nodeId, 1);
 }
 
 TEST(crossingMinimizationTest, deconstructedRenderingNoMinimizationCrossing) {
@@ -484,8 +511,9 @@ TEST(crossingMinimizationTest, deconstructedRenderingNoMinimizationCrossing) {
 2     3
 )";
   auto [dag, layers] = parseWithLayers(str);
-  layers = insertCrossNodes(dag, layers);
-  EXPECT_EQ(str, '\n' + renderDAGWithLayers(dag, layers));
+  GraphIndex index(dag);
+  layers = insertCrossNodes(index, layers);
+  EXPECT_EQ(str, '\n' + renderDAGWithLayers(dag, index, layers));
 }
 
 TEST(crossingMinimizationTest, deconstructedRenderingCrossingRemoved) {
@@ -497,12 +525,13 @@ TEST(crossingMinimizationTest, deconstructedRenderingCrossingRemoved) {
 2   3
 )";
   auto [dag, layers] = parseWithLayers(str);
-  minimizeCrossings(layers, dag);
+  GraphIndex index(dag);
+  minimizeCrossings(layers, index);
   EXPECT_EQ(R"(
 0 1
 | |
 3 2
-)", '\n' + renderDAGWithLayers(dag, layers));
+)", '\n' + renderDAGWithLayers(dag, index, layers));
 }
 
 TEST(crossingMinimizationTest, danglingNodeDoesNotPreventSimpleSwap) {
@@ -529,7 +558,8 @@ TEST(crossingMinimizationTest, danglingNodeDoesNotPreventSimpleSwap) {
 7    8
 )";
   auto [dag, layers] = parseWithLayers(str);
-  minimizeCrossings(layers, dag);
+  GraphIndex index(dag);
+  minimizeCrossings(layers, index);
   EXPECT_EQ(R"(
   0     1
  /|\   /|\
@@ -560,5 +590,67 @@ TEST(crossingMinimizationTest, danglingNodeDoesNotPreventSimpleSwap) {
 |  || /
 |  \|/
 7   8
-)", '\n' + renderDAGWithLayers(dag, layers));
+)", '\n' + renderDAGWithLayers(dag, index, layers));
+}
+
+namespace {
+
+size_t crossingsAfterMinimization(DAG const& dag, RenderOptions const& options) {
+  GraphIndex index(dag);
+  Layering layers;
+  EXPECT_FALSE(layerDAG(index, layers, options).has_value());
+  minimizeCrossings(layers, index, options);
+  size_t ret = 0;
+  for (size_t layerI = 1; layerI < layers.size(); ++layerI) {
+    ret += countCrossings(index, layers, layerI - 1);
+  }
+  return ret;
+}
+
+} // namespace
+
+TEST(crossingMinimizationTest, medianIgnoresFarOffNeighbor) {
+  DAG dag;
+  dag.nodes = {{{3}, "0"}, {{2, 3, 4}, "1"}, {{3, 5}, "2"}, {{}, "3"}, {{}, "4"}, {{}, "5"}};
+  RenderOptions options;
+  EXPECT_EQ(crossingsAfterMinimization(dag, options), 1U);
+  options.crossingHeuristic = RenderOptions::CrossingHeuristic::Median;
+  EXPECT_EQ(crossingsAfterMinimization(dag, options), 0U);
+}
+
+TEST(crossingMinimizationTest, sweepsGoOnWhileCrossingsDrop) {
+  DAG dag;
+  dag.nodes = {{{5}, "0"}, {{4, 5}, "1"}, {{3, 5}, "2"}, {{4, 5}, "3"}, {{}, "4"}, {{}, "5"}};
+  RenderOptions options;
+  EXPECT_EQ(crossingsAfterMinimization(dag, options), 2U);
+  options.maxSweeps = 10;
+  EXPECT_EQ(crossingsAfterMinimization(dag, options), 1U);
+}
+
+TEST(crossingMinimizationTest, siftingMovesNodesPastSweepOptimum) {
+  DAG dag;
+  dag.nodes = {{{1, 3, 4, 5}, "0"}, {{3, 5}, "1"}, {{3, 4, 5}, "2"}, {{}, "3"}, {{}, "4"}, {{}, "5"}};
+  RenderOptions options;
+  EXPECT_EQ(crossingsAfterMinimization(dag, options), 3U);
+  options.crossingReduction = RenderOptions::CrossingReduction::Sifting;
+  EXPECT_EQ(crossingsAfterMinimization(dag, options), 2U);
+}
+
+TEST(crossingMinimizationTest, siftingNeverAddsCrossings) {
+  std::mt19937_64 gen(25);
+  RenderOptions sifting;
+  sifting.crossingReduction = RenderOptions::CrossingReduction::Sifting;
+  for (size_t i = 0; i < 200; ++i) {
+    DAG dag;
+    size_t const nodeCount = 4 + gen() % 6;
+    for (size_t nodeId = 0; nodeId < nodeCount; ++nodeId) {
+      dag.nodes.push_back({{}, "n"});
+      for (size_t pred = 0; pred < nodeId; ++pred) {
+        if (gen() % 3 == 0) {
+          dag.nodes[pred].succs.push_back(nodeId);
+        }
+      }
+    }
+    EXPECT_LE(crossingsAfterMinimization(dag, sifting), crossingsAfterMinimization(dag, {}));
+  }
 }
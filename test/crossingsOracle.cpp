@@ -0,0 +1,26 @@
+#include "testUtils.h"
+
+#include <algorithm>
+
+namespace asciidag::tests {
+
+size_t countCrossingsPairwise(DAG const& dag, Vec<size_t> const& lAbove, Vec<size_t> const& lBelow) {
+  auto pos = [&lBelow](size_t nodeId) {
+    return std::find(lBelow.begin(), lBelow.end(), nodeId) - lBelow.begin();
+  };
+  size_t ret = 0;
+  for (size_t leftTopPos = 0; leftTopPos < lAbove.size(); ++leftTopPos) {
+    for (size_t rightTopPos = leftTopPos + 1; rightTopPos < lAbove.size(); ++rightTopPos) {
+      for (size_t rightBottom : dag.nodes[lAbove[leftTopPos]].succs) {
+        for (size_t leftBottom : dag.nodes[lAbove[rightTopPos]].succs) {
+          if (pos(leftBottom) < pos(rightBottom)) {
+            ++ret;
+          }
+        }
+      }
+    }
+  }
+  return ret;
+}
+
+} // namespace asciidag::tests
@@ -90,6 +90,17 @@ bool drawEdgeFromSpecFails(string const& spec) {
   return !success;
 }
 
+TEST(canvas, renderTrimsEveryLine) {
+  auto canvas = Canvas::fromString("ab  \n  c\n   \n");
+  EXPECT_EQ(canvas.width(), 4);
+  EXPECT_EQ(canvas.height(), 3);
+  EXPECT_EQ(canvas.render(), "ab\n  c\n\n");
+  canvas.clearPos({1, 2});
+  canvas.newMark({2, 3}, 'd');
+  canvas.clearPos({0, 0});
+  EXPECT_EQ(canvas.render(), " b\n\n   d\n");
+}
+
 TEST(drawEdge, straightDownLen1) {
   std::string spec = R"(
   .
@@ -0,0 +1,125 @@
+#include "asciidagImpl.h"
+
+#include <gtest/gtest.h>
+
+using namespace asciidag;
+using namespace asciidag::detail;
+
+void expectConsistent(Layering const& layers) {
+  for (size_t layerI = 0; layerI < layers.size(); ++layerI) {
+    for (size_t pos = 0; pos < layers[layerI].size(); ++pos) {
+      size_t nodeId = layers[layerI][pos];
+      EXPECT_TRUE(layers.contains(nodeId));
+      EXPECT_EQ(layers.layerOf(nodeId), layerI);
+      EXPECT_EQ(layers.posOf(nodeId), pos);
+    }
+  }
+}
+
+TEST(layering, constructedFromLayers) {
+  Layering layers({{3, 0}, {1, 5, 2}});
+  ASSERT_EQ(layers.size(), 2U);
+  EXPECT_FALSE(layers.contains(4));
+  EXPECT_FALSE(layers.contains(6));
+  EXPECT_EQ(layers.layerOf(5), 1U);
+  EXPECT_EQ(layers.posOf(5), 1U);
+  expectConsistent(layers);
+}
+
+TEST(layering, appendKeepsPositions) {
+  Layering layers;
+  layers.appendLayer({2, 0});
+  layers.appendLayer({1});
+  layers.appendNode(1, 7);
+  layers.appendNode(0, 3);
+  EXPECT_EQ(layers[0], (Vec<size_t>{2, 0, 3}));
+  EXPECT_EQ(layers[1], (Vec<size_t>{1, 7}));
+  EXPECT_EQ(layers.posOf(7), 1U);
+  EXPECT_EQ(layers.layerOf(3), 0U);
+  expectConsistent(layers);
+}
+
+TEST(layering, reorderingKeepsPositions) {
+  Layering layers({{0}, {1, 2, 3, 4}});
+  layers.swapNeighbors(1, 2);
+  EXPECT_EQ(layers[1], (Vec<size_t>{1, 3, 2, 4}));
+  expectConsistent(layers);
+  layers.stableSortLayer(1, [](size_t a, size_t b) { return b < a; });
+  EXPECT_EQ(layers[1], (Vec<size_t>{4, 3, 2, 1}));
+  expectConsistent(layers);
+  layers.reorderLayer(1, {2, 4, 1, 3});
+  EXPECT_EQ(layers.posOf(1), 2U);
+  expectConsistent(layers);
+}
+
+TEST(layering, widthBoundedKeepsLayersNarrow) {
+  DAG dag;
+  dag.nodes.push_back({{1, 2, 3, 4, 5, 6}, "root_of_all"});
+  for (char c = 'a'; c < 'g'; ++c) {
+    dag.nodes.push_back({{7}, std::string(1, c)});
+  }
+  dag.nodes.push_back({{}, "z"});
+  GraphIndex index(dag);
+  Layering layers;
+  RenderOptions options;
+  options.layerAssignment = RenderOptions::LayerAssignment::WidthBounded;
+  options.maxLayerWidth = 2;
+  ASSERT_FALSE(layerDAG(index, layers, options).has_value());
+  expectConsistent(layers);
+  EXPECT_EQ(layers.size(), 5U);
+  for (size_t layerI = 0; layerI < layers.size(); ++layerI) {
+    auto const& layer = layers[layerI];
+    EXPECT_LE(std::count_if(layer.begin(), layer.end(), [&index](size_t n) {
+      return index.kind(n) == NodeKind::Regular;
+    }), 2);
+    for (size_t n : layer) {
+      for (size_t succ : index.succs(n)) {
+        EXPECT_EQ(layers.layerOf(succ), layerI + 1);
+      }
+    }
+  }
+}
+
+TEST(layering, minimumSpanShortensSideBranches) {
+  // 0 -> 1 -> 2 -> 3 is the spine, 4 -> 3 a side branch hanging from the root layer
+  DAG dag;
+  dag.nodes = {{{1}, "0"}, {{2}, "1"}, {{3}, "2"}, {{}, "3"}, {{3}, "4"}};
+  for (auto assignment : {RenderOptions::LayerAssignment::LongestPath,
+                          RenderOptions::LayerAssignment::MinimumSpan}) {
+    GraphIndex index(dag);
+    Layering layers;
+    RenderOptions options;
+    options.layerAssignment = assignment;
+    ASSERT_FALSE(layerDAG(index, layers, options).has_value());
+    expectConsistent(layers);
+    size_t nWaypoints = index.size() - dag.nodes.size();
+    if (assignment == RenderOptions::LayerAssignment::MinimumSpan) {
+      EXPECT_EQ(nWaypoints, 0U);
+      EXPECT_EQ(layers.layerOf(4), 2U);
+    } else {
+      EXPECT_EQ(nWaypoints, 2U);
+      EXPECT_EQ(layers.layerOf(4), 0U);
+    }
+  }
+}
+
+TEST(layering, waypointsStayOutOfTheDAG) {
+  DAG dag;
+  dag.nodes = {{{1, 2}, "a"}, {{2}, "b"}, {{}, "c"}};
+  DAG const original = dag;
+  GraphIndex index(dag);
+  Layering layers;
+  ASSERT_FALSE(layerDAG(index, layers).has_value());
+  EXPECT_EQ(dag.nodes.size(), original.nodes.size());
+  EXPECT_EQ(dag.nodes[0].succs, original.nodes[0].succs);
+  ASSERT_EQ(index.size(), 4U);
+  EXPECT_EQ(index.kind(3), NodeKind::Waypoint);
+  EXPECT_EQ(layers.layerOf(3), 1U);
+  EXPECT_EQ(std::count(index.succs(0).begin(), index.succs(0).end(), 3), 1);
+  EXPECT_EQ(std::count(index.succs(0).begin(), index.succs(0).end(), 2), 0);
+  ASSERT_EQ(index.succs(3).size(), 1U);
+  EXPECT_EQ(index.succs(3)[0], 2U);
+  ASSERT_EQ(index.preds(3).size(), 1U);
+  EXPECT_EQ(index.preds(3)[0], 0U);
+  EXPECT_EQ(std::count(index.preds(2).begin(), index.preds(2).end(), 3), 1);
+}
@@ -5,6 +5,7 @@
 #include <gtest/gtest-param-test.h>
 #include <gtest/gtest.h>
 #include <random>
+#include <set>
 
 using namespace asciidag;
 using namespace asciidag::tests;
@@ -44,6 +45,27 @@ TEST(parseRender, stableSuccs) {
   ASSERT_NO_FATAL_FAILURE(assertRenderAndParseIdentity(dag));
 }
 
+TEST(parseRender, siftingKeepsCrossNodeSides) {
+  // Sifting the nodes below some of the inserted "X" crosses, freed from their sides,
+  // would hook the edges up to the wrong nodes
+  DAG dag;
+  dag.nodes = {
+    {{1, 6}, "0"},
+    {{6, 7, 9}, "1"},
+    {{4, 9}, "2"},
+    {{6, 7}, "3"},
+    {{5, 8}, "4"},
+    {{}, "5"},
+    {{7, 9}, "6"},
+    {{}, "7"},
+    {{}, "8"},
+    {{}, "9"},
+  };
+  RenderOptions options;
+  options.crossingReduction = RenderOptions::CrossingReduction::Sifting;
+  ASSERT_NO_FATAL_FAILURE(assertRenderAndParseIdentity(dag, options));
+}
+
 TEST(parseRender, stablePreds) {
   DAG dag;
   dag.nodes.push_back(DAG::Node{{3, 4, 5}, "0"});
@@ -111,6 +133,53 @@ TEST(parseRender, threeIterationsToReadjustEdges) {
   ASSERT_NO_FATAL_FAILURE(assertRenderAndParseIdentity(dag));
 }
 
+TEST(parseRender, tallGraphSameWithThreads) {
+  // Enough edges to draw the bands between the layers in parallel
+  DAG dag;
+  size_t const nNodes = 150;
+  for (size_t i = 0; i < nNodes; ++i) {
+    DAG::Node node{{}, std::to_string(i)};
+    for (size_t succ = i + 1; succ < std::min(i + 4, nNodes); ++succ) {
+      node.succs.push_back(succ);
+    }
+    dag.nodes.push_back(node);
+  }
+  RenderOptions serial;
+  serial.threads = 1;
+  RenderOptions parallel;
+  parallel.threads = 4;
+  RenderError err;
+  auto serialPic = renderDAG(dag, err, serial);
+  ASSERT_TRUE(serialPic.has_value());
+  auto parallelPic = renderDAG(dag, err, parallel);
+  ASSERT_TRUE(parallelPic.has_value());
+  EXPECT_EQ(*serialPic, *parallelPic);
+  ASSERT_NO_FATAL_FAILURE(assertRenderAndParseIdentity(dag, parallel));
+}
+
+TEST(parseRender, forestSameWithThreads) {
+  DAG dag;
+  size_t const nTrees = 12;
+  for (size_t tree = 0; tree < nTrees; ++tree) {
+    size_t root = dag.nodes.size();
+    dag.nodes.push_back({{root + 1, root + 2}, "r" + std::to_string(tree)});
+    dag.nodes.push_back({{root + 3}, "a" + std::to_string(tree)});
+    dag.nodes.push_back({{root + 3}, "b" + std::to_string(tree)});
+    dag.nodes.push_back({{}, "c" + std::to_string(tree)});
+  }
+  RenderOptions serial;
+  serial.threads = 1;
+  RenderOptions parallel;
+  parallel.threads = 4;
+  RenderError err;
+  auto serialPic = renderDAG(dag, err, serial);
+  ASSERT_TRUE(serialPic.has_value());
+  auto parallelPic = renderDAG(dag, err, parallel);
+  ASSERT_TRUE(parallelPic.has_value());
+  EXPECT_EQ(*serialPic, *parallelPic);
+  ASSERT_NO_FATAL_FAILURE(assertRenderAndParseIdentity(dag, parallel));
+}
+
 std::string rectLabel(char filler, size_t width, size_t height) {
   std::string ret;
   bool first = true;
@@ -253,6 +322,192 @@ TEST_P(enumerateAllGraphs, parseOfRenderIsIdentity) {
   }
 }
 
+/// The original exhaustive search for the left-most non-conflicting crossings,
+/// kept as the reference for the sweep-based findNonConflictingCrossings
+Vec<CrossingPair> findNonConflictingCrossingsReference(
+  GraphIndex const& index,
+  Vec<size_t> const& lAbove,
+  Vec<size_t> const& lBelow
+) {
+  auto isEdge = [&index](size_t from, size_t to) {
+    auto succs = index.succs(from);
+    return std::find(succs.begin(), succs.end(), to) != succs.end();
+  };
+  Vec<CrossingPair> ret;
+  std::set<std::pair<size_t, size_t>> takenEdges;
+  for (size_t leftTopPos = 0; leftTopPos < lAbove.size(); ++leftTopPos) {
+    auto leftTop = lAbove[leftTopPos];
+    for (size_t rightBottomPos = 1; rightBottomPos < lBelow.size(); ++rightBottomPos) {
+      auto rightBottom = lBelow[rightBottomPos];
+      if (!isEdge(leftTop, rightBottom) || takenEdges.count({leftTop, rightBottom})) {
+        continue;
+      }
+      bool found = false;
+      for (size_t rightTopPos = leftTopPos + 1; rightTopPos < lAbove.size() && !found;
+           ++rightTopPos) {
+        auto rightTop = lAbove[rightTopPos];
+        for (size_t leftBottomPos = 0; leftBottomPos < rightBottomPos; ++leftBottomPos) {
+          auto leftBottom = lBelow[leftBottomPos];
+          if (isEdge(rightTop, leftBottom) && takenEdges.count({rightTop, leftBottom}) == 0) {
+            takenEdges.insert({rightTop, leftBottom});
+            takenEdges.insert({leftTop, rightBottom});
+            ret.push_back({leftTop, rightTop, leftBottom, rightBottom});
+            found = true;
+            break;
+          }
+        }
+      }
+    }
+  }
+  return ret;
+}
+
+void expectSameCrossings(Vec<CrossingPair> const& expected, Vec<CrossingPair> const& actual) {
+  ASSERT_EQ(expected.size(), actual.size());
+  for (size_t i = 0; i < expected.size(); ++i) {
+    EXPECT_EQ(expected[i].fromLeft, actual[i].fromLeft);
+    EXPECT_EQ(expected[i].fromRight, actual[i].fromRight);
+    EXPECT_EQ(expected[i].toLeft, actual[i].toLeft);
+    EXPECT_EQ(expected[i].toRight, actual[i].toRight);
+  }
+}
+
+/// The predecessors of every node are exactly the nodes listing it as a successor,
+/// and the inserted nodes are as big as their drawing
+void expectIndexInSync(GraphIndex const& index, size_t nOriginalNodes) {
+  Vec2<size_t> expectedPreds(index.size());
+  for (size_t n = 0; n < index.size(); ++n) {
+    for (size_t succ : index.succs(n)) {
+      expectedPreds[succ].push_back(n);
+    }
+  }
+  for (size_t n = 0; n < index.size(); ++n) {
+    Vec<size_t> preds(index.preds(n).begin(), index.preds(n).end());
+    std::sort(preds.begin(), preds.end());
+    EXPECT_EQ(preds, expectedPreds[n]);
+    if (nOriginalNodes <= n) {
+      EXPECT_NE(index.kind(n), NodeKind::Regular);
+      EXPECT_EQ(index.dimensions()[n], (Position{1, 1}));
+    }
+  }
+}
+
+/// Replays the crossing-removal loop of renderDAG,
+/// comparing the crossings found on every pair of layers with the reference
+void assertCrossingsMatchReference(DAG const& dag) {
+  Layering layers;
+  GraphIndex index(dag);
+  ASSERT_FALSE(layerDAG(index, layers).has_value());
+  ASSERT_NO_FATAL_FAILURE(expectIndexInSync(index, dag.nodes.size()));
+  minimizeCrossings(layers, index);
+  for (int i = 0; i < 16; ++i) {
+    size_t nCrossings = 0;
+    for (size_t layerI = 1; layerI < layers.size(); ++layerI) {
+      nCrossings += countCrossings(index, layers, layerI - 1);
+      ASSERT_NO_FATAL_FAILURE(expectSameCrossings(
+        findNonConflictingCrossingsReference(index, layers[layerI - 1], layers[layerI]),
+        findNonConflictingCrossings(index, layers[layerI - 1], layers[layerI])
+      ));
+    }
+    if (nCrossings == 0) {
+      break;
+    }
+    layers = insertCrossNodes(index, layers);
+    ASSERT_NO_FATAL_FAILURE(expectIndexInSync(index, dag.nodes.size()));
+    minimizeCrossings(layers, index);
+  }
+}
+
+TEST_P(enumerateAllGraphs, crossingsSweepMatchesReference) {
+  DAG dag;
+  auto const [nodeLabel, nodeCount, from] = GetParam();
+  for (size_t nodeId = 0; nodeId < nodeCount; ++nodeId) {
+    dag.nodes.push_back({{}, (*nodeLabel)[nodeId]});
+  }
+  size_t to = std::min(from + batchSize, numberOfEdgeConfigurations(nodeCount));
+  for (size_t seed = from; seed < to; ++seed) {
+    configureDAGFromSeed(dag, seed);
+    ASSERT_NO_FATAL_FAILURE(assertCrossingsMatchReference(dag));
+  }
+}
+
+TEST_P(enumerateAllGraphs, parseOfMedianAlignedRenderIsIdentity) {
+  DAG dag;
+  auto const [nodeLabel, nodeCount, from] = GetParam();
+  for (size_t nodeId = 0; nodeId < nodeCount; ++nodeId) {
+    dag.nodes.push_back({{}, (*nodeLabel)[nodeId]});
+  }
+  size_t to = std::min(from + batchSize, numberOfEdgeConfigurations(nodeCount));
+  RenderOptions options;
+  options.placement = RenderOptions::Placement::MedianAligned;
+  for (size_t seed = from; seed < to; ++seed) {
+    configureDAGFromSeed(dag, seed);
+    ASSERT_NO_FATAL_FAILURE(assertRenderAndParseIdentity(dag, options));
+  }
+}
+
+TEST_P(enumerateAllGraphs, parseOfWidthBoundedRenderIsIdentity) {
+  DAG dag;
+  auto const [nodeLabel, nodeCount, from] = GetParam();
+  for (size_t nodeId = 0; nodeId < nodeCount; ++nodeId) {
+    dag.nodes.push_back({{}, (*nodeLabel)[nodeId]});
+  }
+  size_t to = std::min(from + batchSize, numberOfEdgeConfigurations(nodeCount));
+  RenderOptions options;
+  options.layerAssignment = RenderOptions::LayerAssignment::WidthBounded;
+  options.maxLayerWidth = 2;
+  for (size_t seed = from; seed < to; ++seed) {
+    configureDAGFromSeed(dag, seed);
+    ASSERT_NO_FATAL_FAILURE(assertRenderAndParseIdentity(dag, options));
+  }
+}
+
+TEST_P(enumerateAllGraphs, parseOfMinimumSpanRenderIsIdentity) {
+  DAG dag;
+  auto const [nodeLabel, nodeCount, from] = GetParam();
+  for (size_t nodeId = 0; nodeId < nodeCount; ++nodeId) {
+    dag.nodes.push_back({{}, (*nodeLabel)[nodeId]});
+  }
+  size_t to = std::min(from + batchSize, numberOfEdgeConfigurations(nodeCount));
+  RenderOptions options;
+  options.layerAssignment = RenderOptions::LayerAssignment::MinimumSpan;
+  for (size_t seed = from; seed < to; ++seed) {
+    configureDAGFromSeed(dag, seed);
+    ASSERT_NO_FATAL_FAILURE(assertRenderAndParseIdentity(dag, options));
+  }
+}
+
+TEST_P(enumerateAllGraphs, parseOfMedianSweepsRenderIsIdentity) {
+  DAG dag;
+  auto const [nodeLabel, nodeCount, from] = GetParam();
+  for (size_t nodeId = 0; nodeId < nodeCount; ++nodeId) {
+    dag.nodes.push_back({{}, (*nodeLabel)[nodeId]});
+  }
+  size_t to = std::min(from + batchSize, numberOfEdgeConfigurations(nodeCount));
+  RenderOptions options;
+  options.crossingHeuristic = RenderOptions::CrossingHeuristic::Median;
+  options.maxSweeps = 8;
+  for (size_t seed = from; seed < to; ++seed) {
+    configureDAGFromSeed(dag, seed);
+    ASSERT_NO_FATAL_FAILURE(assertRenderAndParseIdentity(dag, options));
+  }
+}
+
+TEST_P(enumerateAllGraphs, parseOfSiftedRenderIsIdentity) {
+  DAG dag;
+  auto const [nodeLabel, nodeCount, from] = GetParam();
+  for (size_t nodeId = 0; nodeId < nodeCount; ++nodeId) {
+    dag.nodes.push_back({{}, (*nodeLabel)[nodeId]});
+  }
+  size_t to = std::min(from + batchSize, numberOfEdgeConfigurations(nodeCount));
+  RenderOptions options;
+  options.crossingReduction = RenderOptions::CrossingReduction::Sifting;
+  for (size_t seed = from; seed < to; ++seed) {
+    configureDAGFromSeed(dag, seed);
+    ASSERT_NO_FATAL_FAILURE(assertRenderAndParseIdentity(dag, options));
+  }
+}
+
 TEST_P(probeRandomGraphs, parseOfRenderIsIdentity) {
   auto const [nodeCount, seed] = GetParam();
   std::mt19937_64 gen(seed);
@@ -267,6 +522,88 @@ TEST_P(probeRandomGraphs, parseOfRenderIsIdentity) {
   }
 }
 
+TEST_P(probeRandomGraphs, parseOfMedianAlignedRenderIsIdentity) {
+  auto const [nodeCount, seed] = GetParam();
+  std::mt19937_64 gen(seed);
+  gen.discard(1);
+  size_t nodesSeed = gen();
+  size_t edgesSeed = gen();
+  DAG dag = graphNodesFromSeed(nodesSeed, nodeCount);
+  RenderOptions options;
+  options.placement = RenderOptions::Placement::MedianAligned;
+  for (size_t i = 0; i < std::min(batchSize, numberOfEdgeConfigurations(nodeCount)); ++i) {
+    edgesSeed = gen();
+    configureDAGFromSeed(dag, edgesSeed);
+    ASSERT_NO_FATAL_FAILURE(assertRenderAndParseIdentity(dag, options));
+  }
+}
+
+TEST_P(probeRandomGraphs, parseOfWidthBoundedRenderIsIdentity) {
+  auto const [nodeCount, seed] = GetParam();
+  std::mt19937_64 gen(seed);
+  gen.discard(1);
+  size_t nodesSeed = gen();
+  size_t edgesSeed = gen();
+  DAG dag = graphNodesFromSeed(nodesSeed, nodeCount);
+  RenderOptions options;
+  options.layerAssignment = RenderOptions::LayerAssignment::WidthBounded;
+  options.maxLayerWidth = 2;
+  for (size_t i = 0; i < std::min(batchSize, numberOfEdgeConfigurations(nodeCount)); ++i) {
+    edgesSeed = gen();
+    configureDAGFromSeed(dag, edgesSeed);
+    ASSERT_NO_FATAL_FAILURE(assertRenderAndParseIdentity(dag, options));
+  }
+}
+
+TEST_P(probeRandomGraphs, parseOfMinimumSpanRenderIsIdentity) {
+  auto const [nodeCount, seed] = GetParam();
+  std::mt19937_64 gen(seed);
+  gen.discard(1);
+  size_t nodesSeed = gen();
+  size_t edgesSeed = gen();
+  DAG dag = graphNodesFromSeed(nodesSeed, nodeCount);
+  RenderOptions options;
+  options.layerAssignment = RenderOptions::LayerAssignment::MinimumSpan;
+  for (size_t i = 0; i < std::min(batchSize, numberOfEdgeConfigurations(nodeCount)); ++i) {
+    edgesSeed = gen();
+    configureDAGFromSeed(dag, edgesSeed);
+    ASSERT_NO_FATAL_FAILURE(assertRenderAndParseIdentity(dag, options));
+  }
+}
+
+TEST_P(probeRandomGraphs, parseOfMedianSweepsRenderIsIdentity) {
+  auto const [nodeCount, seed] = GetParam();
+  std::mt19937_64 gen(seed);
+  gen.discard(1);
+  size_t nodesSeed = gen();
+  size_t edgesSeed = gen();
+  DAG dag = graphNodesFromSeed(nodesSeed, nodeCount);
+  RenderOptions options;
+  options.crossingHeuristic = RenderOptions::CrossingHeuristic::Median;
+  options.maxSweeps = 8;
+  for (size_t i = 0; i < std::min(batchSize, numberOfEdgeConfigurations(nodeCount)); ++i) {
+    edgesSeed = gen();
+    configureDAGFromSeed(dag, edgesSeed);
+    ASSERT_NO_FATAL_FAILURE(assertRenderAndParseIdentity(dag, options));
+  }
+}
+
+TEST_P(probeRandomGraphs, parseOfSiftedRenderIsIdentity) {
+  auto const [nodeCount, seed] = GetParam();
+  std::mt19937_64 gen(seed);
+  gen.discard(1);
+  size_t nodesSeed = gen();
+  size_t edgesSeed = gen();
+  DAG dag = graphNodesFromSeed(nodesSeed, nodeCount);
+  RenderOptions options;
+  options.crossingReduction = RenderOptions::CrossingReduction::Sifting;
+  for (size_t i = 0; i < std::min(batchSize, numberOfEdgeConfigurations(nodeCount)); ++i) {
+    edgesSeed = gen();
+    configureDAGFromSeed(dag, edgesSeed);
+    ASSERT_NO_FATAL_FAILURE(assertRenderAndParseIdentity(dag, options));
+  }
+}
+
 INSTANTIATE_TEST_SUITE_P(
   testSome345nodeGraphs,
   probeRandomGraphs,
@@ -1,6 +1,9 @@
 #include "asciidag.h"
+#include "asciidagImpl.h"
 
 #include <gtest/gtest.h>
+#include <random>
+#include <sstream>
 #include <string>
 
 using namespace asciidag;
@@ -108,6 +111,40 @@ std::vector<std::string> nodes(Arg ...args) {
   return ret;
 }
 
+std::optional<DAG> parseInChunks(std::string_view str, size_t chunkSize, ParseError& err) {
+  ParseSession session;
+  for (size_t start = 0; start < str.size(); start += chunkSize) {
+    if (!session.feed(str.substr(start, chunkSize))) {
+      break;
+    }
+  }
+  return session.finish(err);
+}
+
+std::string toString(DAG const& dag) {
+  std::stringstream ss;
+  ss << dag;
+  return ss.str();
+}
+
+void expectSameWhenChunked(std::string_view str, DAG const& whole) {
+  for (size_t chunkSize : {1, 2, 7}) {
+    ParseError err;
+    auto chunked = parseInChunks(str, chunkSize, err);
+    EXPECT_EQ(err.code, ParseError::Code::None);
+    ASSERT_TRUE(chunked.has_value());
+    EXPECT_EQ(toString(whole), toString(*chunked));
+  }
+}
+
+void expectSameInPlace(std::string_view str, DAG const& copied) {
+  ParseError err;
+  auto inPlace = parseDAGInPlace(str, err);
+  EXPECT_EQ(err.code, ParseError::Code::None);
+  ASSERT_TRUE(inPlace.has_value());
+  EXPECT_EQ(toString(copied), toString(inPlace->toDAG()));
+}
+
 DAGWithFunctions parseSuccessfully(std::string_view str) {
   ParseError err;
   auto dag = parseDAG(str, err);
@@ -122,6 +159,8 @@ DAGWithFunctions parseSuccessfully(std::string_view str) {
   if (dag) {
     checkRectangularNodes(*dag);
     checkValidEdges(*dag);
+    expectSameWhenChunked(str, *dag);
+    expectSameInPlace(str, *dag);
     return {*dag};
   }
   return DAGWithFunctions{};
@@ -672,6 +711,16 @@ TEST(parseError, danglingPipeDisconnectedNodes) {
   EXPECT_EQ(err.pos, (Position{2U, 5U}));
 }
 
+TEST(parseError, danglingEdgeFarRight) {
+  std::string pad(100, ' ');
+  std::string str = "\n" + pad + ".  .\n" + pad + "|  |\n" + pad + "   .\n";
+  ParseError err;
+  auto result = parseDAG(str, err);
+  EXPECT_FALSE(result.has_value());
+  ASSERT_EQ(err.code, ParseError::Code::DanglingEdge);
+  EXPECT_EQ(err.pos, (Position{2U, 101U}));
+}
+
 TEST(parseError, danglingSlash) {
   std::string str = R"(
     .
@@ -2182,3 +2231,83 @@ TEST(parse, fiveCrosses) {
   ASSERT_EQ(dag.node("E").succs(), nodes());
   ASSERT_EQ(dag.node("F").succs(), nodes());
 }
+
+TEST(parseSession, errorStopsFeeding) {
+  ParseSession session;
+  EXPECT_TRUE(session.feed("\n    .\n"));
+  EXPECT_FALSE(session.feed("  |\n"));
+  EXPECT_FALSE(session.feed("  .\n"));
+  ParseError err;
+  EXPECT_FALSE(session.finish(err).has_value());
+  EXPECT_EQ(err.code, ParseError::Code::SuspendedEdge);
+  EXPECT_EQ(err.pos, (Position{2U, 3U}));
+}
+
+TEST(parseSession, linesWiderThanTheFirstChunk) {
+  ParseSession session;
+  session.feed("\n.\n|\n");
+  session.feed(". ");
+  session.feed("      long\n");
+  session.feed("         |\n");
+  session.feed("         .\n");
+  ParseError err;
+  auto dag = session.finish(err);
+  ASSERT_TRUE(dag.has_value());
+  EXPECT_EQ(toString(*dag), "DAG{.->[.], .->[], long->[.], .->[]}");
+}
+
+TEST(parseScan, runLengthsMatchCharByChar) {
+  std::mt19937 gen(7);
+  std::string const alphabet = "  \n|/\\ab";
+  for (size_t len = 0; len < 70; ++len) {
+    std::string str;
+    for (size_t i = 0; i < len; ++i) {
+      // Mostly long runs of one kind, to cross the vector-width boundaries
+      str.push_back(gen() % 8 == 0 ? alphabet[gen() % alphabet.size()] : (len % 2 ? ' ' : 'a'));
+    }
+    size_t spaces = 0;
+    while (spaces < str.size() && str[spaces] == ' ') {
+      ++spaces;
+    }
+    size_t nodeChars = 0;
+    while (nodeChars < str.size() && std::string(" \n|/\\").find(str[nodeChars]) == std::string::npos) {
+      ++nodeChars;
+    }
+    EXPECT_EQ(detail::countLeadingSpaces(str), spaces) << str;
+    EXPECT_EQ(detail::countLeadingNodeChars(str), nodeChars) << str;
+  }
+}
+
+TEST(parseInPlace, labelsAreSourceRectangles) {
+  std::string str = R"(
+  aaa
+  a a   b
+   \    |
+    cc  |
+    cc  d
+)";
+  ParseError err;
+  auto dag = parseDAGInPlace(str, err);
+  ASSERT_TRUE(dag.has_value());
+  ASSERT_EQ(dag->nodes.size(), 4);
+  EXPECT_EQ(dag->nodes[0].label.topLeft, (Position{1, 2}));
+  EXPECT_EQ(dag->nodes[0].label.width, 3);
+  EXPECT_EQ(dag->nodes[0].label.height, 2);
+  EXPECT_EQ(dag->text(0), "aaa\na a");
+  EXPECT_EQ(dag->text(1), "b");
+  EXPECT_EQ(dag->nodes[2].label.topLeft, (Position{4, 4}));
+  EXPECT_EQ(dag->text(2), "cc\ncc");
+  EXPECT_EQ(dag->text(3), "d");
+  EXPECT_EQ(dag->source.data(), str.data());
+}
+
+TEST(parseInPlace, reportsErrorsLikeParseDAG) {
+  std::string str = R"(
+  .
+   \
+)";
+  ParseError err;
+  EXPECT_FALSE(parseDAGInPlace(str, err).has_value());
+  EXPECT_EQ(err.code, ParseError::Code::DanglingEdge);
+  EXPECT_EQ(err.pos, (Position{2U, 4U}));
+}
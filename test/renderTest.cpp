@@ -6,9 +6,9 @@
 using namespace asciidag;
 using namespace asciidag::tests;
 
-std::string renderSuccessfully(DAG const& dag) {
+std::string renderSuccessfully(DAG const& dag, RenderOptions const& options = {}) {
   RenderError err;
-  auto result = renderDAG(dag, err);
+  auto result = renderDAG(dag, err, options);
   EXPECT_TRUE(result.has_value());
   EXPECT_EQ(err.code, RenderError::Code::None);
   if (!result) {
@@ -72,6 +72,26 @@ TEST(render, twoSimpleEdgesDivergeDiffOrder) {
   ASSERT_NO_FATAL_FAILURE(assertRenderAndParseIdentity(test));
 }
 
+TEST(render, nodesLabelledLikeLayoutNodes) {
+  DAG test;
+  test.nodes.push_back(DAG::Node{{1, 2}, "0"});
+  test.nodes.push_back(DAG::Node{{3}, "X"});
+  test.nodes.push_back(DAG::Node{{3}, "|"});
+  test.nodes.push_back(DAG::Node{{}, "3"});
+  EXPECT_EQ(renderSuccessfully(test),
+            R"(
+0
+|\
+| \
+|  \
+X   |
+|  /
+| /
+|/
+3
+)");
+}
+
 TEST(render, twoSimpleEdgesConverge) {
   DAG test;
   test.nodes.push_back(DAG::Node{{2}, "0"});
@@ -199,15 +219,11 @@ TEST(render, nonStraightRightEdge) {
   test.nodes.push_back(DAG::Node{{}, "5"});
   EXPECT_EQ(renderSuccessfully(test),
             R"(
-0   3
-|\  |\
-| \ | \
-|  \|  \
-|  |\   \
-|  | \   \
-|  |  \   \
-|  \   \   \
-1   2   4   5
+0     3
+|\    |\
+| \   | \
+|  \  |  \
+1   2 4   5
 )");
   ASSERT_NO_FATAL_FAILURE(assertRenderAndParseIdentity(test));
 }
@@ -234,10 +250,10 @@ TEST(render, twoTripleEdgePairs) {
   test.nodes.push_back(DAG::Node{{}, "3"});
   EXPECT_EQ(renderSuccessfully(test),
             R"(
-  0     2
- /|\   /|\
- \|/   \|/
-  1     3
+  0    2
+ /|\  /|\
+ \|/  \|/
+  1    3
 )");
   ASSERT_NO_FATAL_FAILURE(assertRenderAndParseIdentity(test));
 }
@@ -252,15 +268,11 @@ TEST(render, nonStraightLeftEdge) {
   test.nodes.push_back(DAG::Node{{}, "5"});
   EXPECT_EQ(renderSuccessfully(test),
             R"(
-0   1   3   4
-|  /   /   /
-| /   /   /
-|/   /   /
-||  /   /
-||  |  /
-||  | /
-|/  |/
-2   5
+0   1 3   4
+|  /  |  /
+| /   | /
+|/    |/
+2     5
 )");
   ASSERT_NO_FATAL_FAILURE(assertRenderAndParseIdentity(test));
 }
@@ -275,11 +287,11 @@ TEST(render, twoParallelRightEdges) {
   test.nodes.push_back(DAG::Node{{}, "4"});
   EXPECT_EQ(renderSuccessfully(test),
             R"(
-0   3
-|\   \
-| \   \
-|  \   \
-1   2   4
+0     3
+|\    |
+| \   4
+|  \
+1   2
 )");
   ASSERT_NO_FATAL_FAILURE(assertRenderAndParseIdentity(test));
 }
@@ -293,11 +305,9 @@ TEST(render, twoParallelLeftEdges) {
   test.nodes.push_back(DAG::Node{{}, "4"});
   EXPECT_EQ(renderSuccessfully(test),
             R"(
-0   1   3
-   /   /
-  /   /
- /   /
-2   4
+0 1 3
+  | |
+  2 4
 )");
   ASSERT_NO_FATAL_FAILURE(assertRenderAndParseIdentity(test));
 }
@@ -468,6 +478,41 @@ TEST(renderError, tooManyIncomingEdges) {
   EXPECT_EQ(err.nodeId, 4U);
 }
 
+TEST(renderError, selfLoop) {
+  DAG test;
+  test.nodes.push_back(DAG::Node{{0}, "0"});
+  RenderError err;
+  auto result = renderDAG(test, err);
+  EXPECT_FALSE(result.has_value());
+  EXPECT_EQ(err.code, RenderError::Code::Cyclic);
+  EXPECT_EQ(err.nodeId, 0U);
+}
+
+TEST(renderError, cycleBelowRoot) {
+  DAG test;
+  test.nodes.push_back(DAG::Node{{1}, "0"});
+  test.nodes.push_back(DAG::Node{{2}, "1"});
+  test.nodes.push_back(DAG::Node{{1, 3}, "2"});
+  test.nodes.push_back(DAG::Node{{}, "3"});
+  RenderError err;
+  auto result = renderDAG(test, err);
+  EXPECT_FALSE(result.has_value());
+  EXPECT_EQ(err.code, RenderError::Code::Cyclic);
+  EXPECT_EQ(err.nodeId, 1U);
+}
+
+TEST(renderError, selfLoopInSecondComponent) {
+  DAG test;
+  test.nodes.push_back(DAG::Node{{1}, "0"});
+  test.nodes.push_back(DAG::Node{{}, "1"});
+  test.nodes.push_back(DAG::Node{{2}, "2"});
+  RenderError err;
+  auto result = renderDAG(test, err);
+  EXPECT_FALSE(result.has_value());
+  EXPECT_EQ(err.code, RenderError::Code::Cyclic);
+  EXPECT_EQ(err.nodeId, 2U);
+}
+
 TEST(render, conflictingEdgesFromSamePredecessor) {
   DAG test;
   test.nodes.push_back(DAG::Node{{}, "0"});
@@ -477,17 +522,13 @@ TEST(render, conflictingEdgesFromSamePredecessor) {
   test.nodes.push_back(DAG::Node{{}, "4"});
   test.nodes.push_back(DAG::Node{{}, "5"});
   EXPECT_EQ(renderSuccessfully(test), R"(
-0   1   2     3
-   /   / \   /
-  /   /  /  /
- /   /  /  /
-/   /  /  /
-|  /  /  /
-| /  /  /
-|/  /  /
-||  | /
-|/  |/
-4   5
+0 1   2     3
+  |  / \   /
+  | /  /  /
+  |/  /  /
+  ||  | /
+  |/  |/
+  4   5
 )");
   ASSERT_NO_FATAL_FAILURE(assertRenderAndParseIdentity(test));
 }
@@ -526,15 +567,13 @@ TEST(render, dependenciesRightToLeft) {
   test.nodes.push_back(DAG::Node{{}, "3"});
   test.nodes.push_back(DAG::Node{{}, "4"});
   EXPECT_EQ(renderSuccessfully(test), R"(
-0   1   2
-   /   / \
-  /   /  |
- /   /   /
-/   /   /
-|  /   /
-| /   /
-|/   /
-4   3
+0 1   2
+  |  / \
+  | /  /
+  |/  /
+  ||  |
+  |/  |
+  4   3
 )");
   ASSERT_NO_FATAL_FAILURE(assertRenderAndParseIdentity(test));
 }
@@ -675,27 +714,19 @@ TEST(render, crossedPlusUncrossedGraphs) {
   test.nodes.push_back(DAG::Node{{}, "4"});
   test.nodes.push_back(DAG::Node{{}, "5"});
   EXPECT_EQ(renderSuccessfully(test), R"(
-0   1 2
-|\  | |\
-| \ \ \ \
-|  \ \ \ \
-|  | |  \ \
-|  \ /  | |
-|   X   | |
-|  / \  | |
-| /  |  / |
-| |  \ /  |
-| |   X   |
-| |  / \  |
-| \  |  \ |
-|  \ /  | |
-|   X   | |
-|  / \  | |
-| /  /  / /
-|/  /  / /
-||  | / /
-|/  | |/
-3   4 5
+0   2     1
+|\  |\    |
+| \ \ \   4
+|  \ \ \
+|  | |  \
+|  \ /  |
+|   X   |
+|  / \  |
+| /  /  /
+|/  /  /
+||  | /
+|/  |/
+3   5
 )");
   ASSERT_NO_FATAL_FAILURE(assertRenderAndParseIdentity(test));
 }
@@ -952,11 +983,11 @@ TEST(render, full3x3PlusTwoDisconnectedNodes) {
   test.nodes.push_back(DAG::Node{{}, "6"});
   test.nodes.push_back(DAG::Node{{}, "7"});
   EXPECT_EQ(renderSuccessfully(test), R"(
-  0   6   1   7   2
- /|\     /|\     /|\
-/ | \   / | \   / //
-| |  \ /  | |  / //
-| |  | |  | | / / |
+  0     1     2         6 7
+ /|\   /|\   /|\
+/ | \  |\ \  \\ \
+| |  \ | \ \  \\ \
+| |  | |  \ \ | \ \
 | |  \ /  | | | | |
 | |   X   | | | | |
 | |  / \  | | | | |
@@ -1248,8 +1279,8 @@ TEST(render, partialCoverBottomRight) {
   test.nodes.push_back(DAG::Node{{}, "3333"});
   EXPECT_EQ(renderSuccessfully(test),
             R"(
-000 1111
-  |    |
+000   1111
+  |      |
 22222 3333
 )");
   ASSERT_NO_FATAL_FAILURE(assertRenderAndParseIdentity(test));
@@ -1339,13 +1370,12 @@ TEST(render, exitConflictOfDirectEdgeWithLeftEdge) {
   test.nodes.push_back(DAG::Node{{}, "555555"});
   EXPECT_EQ(renderSuccessfully(test),
             R"(
-  0   222   11
- /|\       // \
-/ | \     //  /
-| |  \   //  /
-| |  |  / | /
-| |  | /  | |
-| |  | |  | |
+  0   11                222
+ /|\  |\\
+/ | \ | \\
+| |  \\  \\
+| |  | \  \\
+| |  | |  | \
 | |  \ /  | |
 | |   X   | |
 | |  / \  | |
@@ -1407,11 +1437,9 @@ TEST(render, twoPairsOfLongAndShortNodesConnected) {
             R"(
 0 2
 0 |
-0 |
-| |
+0 3
+| 3
 1 3
-  3
-  3
 )");
   ASSERT_NO_FATAL_FAILURE(assertRenderAndParseIdentity(test));
 }
@@ -1485,14 +1513,9 @@ TEST(render, node1ShorterThanLevel) {
   test.nodes.push_back(DAG::Node{{}, "2"});
   EXPECT_EQ(renderSuccessfully(test),
             R"(
-0   1
-0  /
-   |
-   |
-   /
-  /
- /
-2
+0 1
+0 |
+  2
 )");
   ASSERT_NO_FATAL_FAILURE(assertRenderAndParseIdentity(test));
 }
@@ -1508,17 +1531,17 @@ TEST(render, edgeFromShorterNodeNotHemmingOthers) {
   test.nodes.push_back(DAG::Node{{}, "6"});
   EXPECT_EQ(renderSuccessfully(test),
             R"(
-0   3   5
-0   3    \
-0   |\   |
-|\  ||   |
-||  ||   |
-|\  |\   \
-| \ \ \   \
-|  \ \ \   \
-|  | |  \   \
-|  \ /   \   \
-1   2     4   6
+0   3       5
+0   3       |
+0   |\      6
+|\  ||
+||  ||
+|\  |\
+| \ \ \
+|  \ \ \
+|  | |  \
+|  \ /   \
+1   2     4
 )");
   ASSERT_NO_FATAL_FAILURE(assertRenderAndParseIdentity(test));
 }
@@ -1597,3 +1620,155 @@ TEST(render, potentiallyUnstableNodePosition) {
 )");
   ASSERT_NO_FATAL_FAILURE(assertRenderAndParseIdentity(test));
 }
+
+TEST(render, medianAlignedPlacementShortensEdges) {
+  DAG test;
+  test.nodes.push_back(DAG::Node{{1, 2}, "0"});
+  test.nodes.push_back(DAG::Node{{3}, "left"});
+  test.nodes.push_back(DAG::Node{{4}, "1"});
+  test.nodes.push_back(DAG::Node{{}, "2"});
+  test.nodes.push_back(DAG::Node{{}, "3"});
+  EXPECT_EQ(renderSuccessfully(test),
+            R"(
+0
+|\
+| \
+|  \
+|   \
+|    \
+|     \
+left   1
+|     /
+|    /
+|   /
+|  /
+2 3
+)");
+  RenderOptions options;
+  options.placement = RenderOptions::Placement::MedianAligned;
+  EXPECT_EQ(renderSuccessfully(test, options),
+            R"(
+0
+|\
+| \
+|  \
+|   \
+|    \
+|     \
+left   1
+   |  /
+   |  \
+   |   \
+   |   /
+   2  3
+)");
+  ASSERT_NO_FATAL_FAILURE(assertRenderAndParseIdentity(test, options));
+}
+
+TEST(render, widthBoundedLayersAreNarrower) {
+  DAG test;
+  test.nodes.push_back(DAG::Node{{1, 2, 3, 4}, "root"});
+  test.nodes.push_back(DAG::Node{{}, "a"});
+  test.nodes.push_back(DAG::Node{{}, "b"});
+  test.nodes.push_back(DAG::Node{{}, "c"});
+  test.nodes.push_back(DAG::Node{{}, "d"});
+  EXPECT_EQ(renderSuccessfully(test),
+            R"(
+root
+| \\\
+| | \\
+| |  \\
+| |  | \
+| |  |  \
+| |  |   \
+| |  |   |
+| |  \   \
+a b   c   d
+)");
+  RenderOptions options;
+  options.layerAssignment = RenderOptions::LayerAssignment::WidthBounded;
+  options.maxLayerWidth = 2;
+  EXPECT_EQ(renderSuccessfully(test, options),
+            R"(
+root
+| \\\
+| | \\
+| | | \
+| | | |
+c d | |
+    | |
+    / |
+   /  |
+  /   /
+ /   /
+a   b
+)");
+  ASSERT_NO_FATAL_FAILURE(assertRenderAndParseIdentity(test, options));
+}
+
+TEST(render, disconnectedPartsWrapAtMaxWidth) {
+  DAG test;
+  test.nodes.push_back(DAG::Node{{1}, "0"});
+  test.nodes.push_back(DAG::Node{{}, "1"});
+  test.nodes.push_back(DAG::Node{{3}, "2"});
+  test.nodes.push_back(DAG::Node{{}, "3"});
+  test.nodes.push_back(DAG::Node{{5}, "44"});
+  test.nodes.push_back(DAG::Node{{}, "5"});
+  RenderOptions options;
+  options.maxWidth = 4;
+  EXPECT_EQ(renderSuccessfully(test, options),
+            R"(
+0 2
+| |
+1 3
+
+44
+|
+5
+)");
+  ASSERT_NO_FATAL_FAILURE(assertRenderAndParseIdentity(test, options));
+}
+
+TEST(render, disconnectedPartsDoNotShareLayers) {
+  // Split apart, the two crossed trees have nothing left to cross
+  EXPECT_EQ(parseAndRender(R"(
+ 0   1   2
+  \ / \ /
+   X   X
+  / \ / \
+ 3   4   5
+)"),
+R"(
+0   2 1
+|  /  |\
+| /   | \
+|/    |  \
+4     3   5
+)");
+}
+
+TEST(render, disconnectedPartGoesAside) {
+  // The 1-4 edge no longer crosses the edges of the other part
+  EXPECT_EQ(parseAndRender(R"(
+ 0 1 2
+ |\|/|
+ | X |
+ |/|\|
+ 3 4 5
+)"),
+R"(
+0   2     1
+|\  |\    |
+| \ \ \   4
+|  \ \ \
+|  | |  \
+|  \ /  |
+|   X   |
+|  / \  |
+| /  /  /
+|/  /  /
+||  | /
+|/  |/
+3   5
+)");
+}
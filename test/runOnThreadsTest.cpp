@@ -0,0 +1,35 @@
+#include "asciidagImpl.h"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <stdexcept>
+
+using namespace asciidag::detail;
+
+TEST(runOnThreads, threadsShareTheTasks) {
+  size_t const nTasks = 1000;
+  std::vector<std::atomic<size_t>> runs(nTasks);
+  std::atomic<size_t> next{0};
+  runOnThreads(4, [&]() {
+    for (size_t task = next++; task < nTasks; task = next++) {
+      ++runs[task];
+    }
+  });
+  for (auto const& run : runs) {
+    EXPECT_EQ(run, 1U);
+  }
+}
+
+TEST(runOnThreads, workerExceptionReachesTheCaller) {
+  std::atomic<size_t> next{0};
+  auto work = [&]() {
+    for (size_t task = next++; task < 100; task = next++) {
+      if (task == 17) {
+        throw std::runtime_error("task 17");
+      }
+    }
+  };
+  EXPECT_THROW(runOnThreads(4, work), std::runtime_error);
+  EXPECT_LE(100U, next);
+}
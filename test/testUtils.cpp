@@ -185,7 +185,7 @@ Vec2<size_t> reconstructLayers(
   return ret;
 }
 
-std::pair<DAG, Vec2<size_t>> parseWithLayers(string_view str) {
+std::pair<DAG, Layering> parseWithLayers(string_view str) {
   ParseError parseErr;
   auto dag = parseDAG(str, parseErr);
   EXPECT_EQ(parseErr.code, ParseError::Code::None);
@@ -197,12 +197,13 @@ std::pair<DAG, Vec2<size_t>> parseWithLayers(string_view str) {
     return {};
   }
   auto layerMapping = parseLayers(str);
-  return std::make_pair(std::move(*dag), reconstructLayers(*dag, layerMapping));
+  Layering layers(reconstructLayers(*dag, layerMapping));
+  return std::make_pair(std::move(*dag), std::move(layers));
 }
 
-void assertRenderAndParseIdentity(DAG const& dag) {
+void assertRenderAndParseIdentity(DAG const& dag, RenderOptions const& options) {
   RenderError renderErr;
-  auto pic = renderDAG(dag, renderErr);
+  auto pic = renderDAG(dag, renderErr, options);
   EXPECT_EQ(renderErr.code, RenderError::Code::None);
   if (renderErr.code != RenderError::Code::None) {
     std::cout <<toDOT(dag) <<"\n";
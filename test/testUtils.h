@@ -9,8 +9,12 @@ using namespace asciidag::detail;
 
 string parseAndRender(string_view str);
 
-std::pair<DAG, Vec2<size_t>> parseWithLayers(string_view str);
+std::pair<DAG, Layering> parseWithLayers(string_view str);
 
-void assertRenderAndParseIdentity(DAG const& dag);
+void assertRenderAndParseIdentity(DAG const& dag, RenderOptions const& options = {});
+
+/// Crossings between two layers by comparing every pair of edges, the oracle for countCrossings.
+/// Defined apart from the gtest helpers, so that the benchmarks can link it too
+size_t countCrossingsPairwise(DAG const& dag, Vec<size_t> const& lAbove, Vec<size_t> const& lBelow);
 
 } // namespace asciidag::tests